@@ -0,0 +1,5330 @@
+#include "cpu_info.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <atomic>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#endif
+
+#ifdef __aarch64__
+#include <arm_neon.h>
+#endif
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sched.h>
+#include <linux/mempolicy.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#define HAVE_PERF_EVENTS 1
+#endif
+
+#if defined(__linux__) || defined(__APPLE__)
+#include <sys/mman.h>
+#define HAVE_MMAP 1
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define NOINLINE __attribute__((noinline))
+#else
+#define NOINLINE
+#endif
+
+template<class T>
+static inline void do_not_optimize(const T &value) {
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "r,m"(value) : "memory");
+#else
+    static volatile T sink;
+    sink = value;
+#endif
+}
+
+using high_resolution_clock = std::chrono::high_resolution_clock;
+
+// *------------------------------------------------------------------------------------*
+// |                                 CLI TOOLS                                          |
+// *------------------------------------------------------------------------------------*
+enum class TimerBackend {
+    Chrono,
+    Tsc,
+    Perf,
+};
+
+enum class PageBackend {
+    Default,
+    Thp,
+    Huge2M,
+    Huge1G,
+};
+
+enum class OutputFormat {
+    Text,
+    Json,
+    Csv,
+};
+
+struct Options {
+    bool verbose = false;
+    size_t total_accesses = 16'000'00ULL;
+    int trials = 7;
+    bool hierarchy = false;
+    bool tlb = false;
+    bool bandwidth = false;
+    std::string isa = "auto";
+    size_t max_bytes = 0;
+    TimerBackend timer = TimerBackend::Chrono;
+    bool self_check = false;
+    bool per_cpu = false;
+    std::vector<int> cpus;
+    OutputFormat format = OutputFormat::Text;
+    std::string output_path;
+    bool use_cache = true;
+    bool refresh = false;
+    double tolerance = 0.03;
+    double precision = 0.02;
+    PageBackend pages_size = PageBackend::Default;
+    PageBackend pages_assoc = PageBackend::Default;
+    PageBackend pages_stride = PageBackend::Default;
+    PageBackend pages_mlp = PageBackend::Default;
+    PageBackend pages_prefetch = PageBackend::Thp;     // keeps page walks out of the random baseline
+    PageBackend pages_sets = PageBackend::Thp;         // physical = virtual index bits up to 2 MB
+    PageBackend pages_evict = PageBackend::Thp;        // fixes which candidates share the target's set
+    PageBackend pages_policy = PageBackend::Thp;       // outer-level lines one way size apart share a set
+    bool mlp = false;
+    bool prefetch = false;
+    bool prefetch_msr = false;
+    bool c2c = false;
+    bool numa = false;
+    int mem_node = -1;
+    int cpu_node = -1;
+    double budget_ms = 0.0;     // 0 = no wall-clock limit
+    bool reported = false;
+    bool cross_check = false;
+    bool sets = false;
+    bool evict = false;
+    bool policy = false;
+};
+
+
+static void print_usage(const char *prog) {
+    std::cerr << "Использование: " << prog << " [-v] [-i <int>|-i<int>] [-r <int>|-r<int>] [--hierarchy]"
+              << " [--max-size <MB>]"
+              << " [--timer chrono|tsc|perf] [--self-check] [--per-cpu] [--cpus <list>]"
+              << " [--format text|json|csv] [-o <file>] [--refresh] [--no-cache] [--tolerance <pct>] [--precision <pct>]"
+              << " [--pages <spec>] [--tlb] [--bandwidth] [--isa <name>] [--mlp] [--prefetch] [--prefetch-msr]"
+              << " [--c2c] [--numa] [--mem-node <n>] [--cpu-node <n>]"
+              << " [--budget <ms>] [--reported] [--cross-check] [--sets] [--evict] [--policy]\n"
+              << "  -v               Включает подробный режим\n"
+              << "  -i <int>         Количество итераций обхода данных\n"
+              << "  -r <int>         Количество прогонов вычислений (с --precision — наибольшее)\n"
+              << "  --precision <pct> Прогонять точку, пока 95% интервал медианы шире pct% (по умолчанию 2;\n"
+              << "                   0 — ровно -r прогонов)\n"
+              << "  --budget <ms>    Уложить замеры размера, ассоциативности и линии в ms миллисекунд;\n"
+              << "                   точки у ожидаемых границ замеряются первыми\n"
+              << "  --sets           Определить число наборов и биты индекса L1 (VIPT?) и хеширование индекса L2/L3\n"
+              << "  --evict          Построить минимальные вытесняющие наборы L2/L3: эффективная ассоциативность, CAT\n"
+              << "  --policy         Определить политику замещения L1/L2/L3 (LRU, FIFO, PLRU, RRIP)\n"
+              << "  --reported       Вывести геометрию кешей из sysfs/CPUID без замеров и выйти\n"
+              << "  --cross-check    Сравнить замеренные значения с геометрией из sysfs/CPUID\n"
+              << "  --hierarchy      Определить все уровни иерархии памяти (L1/L2/L3/DRAM)\n"
+              << "  --max-size <MB>  Верхняя граница перебора для --hierarchy (по умолчанию 4 x LLC)\n"
+              << "  --bandwidth      Замерить пропускную способность (read/write/copy/nt_write) по уровням\n"
+              << "  --isa <name>     Ширина векторов для --bandwidth: auto (самая широкая), all, scalar, sse2,\n"
+              << "                   avx2, avx512, neon\n"
+              << "  --mlp            Определить число одновременных промахов (MLP) на каждом уровне\n"
+              << "  --prefetch       Определить поведение аппаратной предвыборки (шаги, направление, страницы)\n"
+              << "  --prefetch-msr   То же, плюс повтор с предвыборкой, выключенной через MSR (Intel, root)\n"
+              << "  --c2c            Матрица задержек передачи линии кеша между парами CPU (ping-pong)\n"
+              << "  --numa           Матрица латентности и пропускной способности DRAM узел CPU x узел памяти\n"
+              << "  --mem-node <n>   Размещать буферы всех замеров на узле NUMA n\n"
+              << "  --cpu-node <n>   Выполнять замеры на CPU узла NUMA n\n"
+              << "  --tlb            Определить число записей DTLB/STLB и стоимость обхода таблиц страниц\n"
+              << "  --tolerance <pct> Точность уточнения границ уровней, % от размера (по умолчанию 3)\n"
+              << "  --pages <spec>   Страницы для буферов: default, thp, 2m, 1g; для отдельного замера\n"
+              << "                   size=<..>,assoc=<..>,stride=<..>,mlp=<..>,\n"
+              << "                   prefetch=<..>,sets=<..>,evict=<..>,policy=<..>\n"
+              << "  --timer <name>   Источник времени: chrono (нс), tsc (такты TSC), perf (такты ядра)\n"
+              << "  --self-check     Измерить накладные расходы замера и выйти\n"
+              << "  --per-cpu        Выполнить замеры на каждом доступном логическом CPU\n"
+              << "  --cpus <list>    То же для выбранных CPU, например 0-3,8\n"
+              << "  --format <name>  Формат результата: text, json или csv (кривые, замеры и оценки)\n"
+              << "  -o <file>        Записать результат json/csv в файл вместо stdout\n"
+              << "  --refresh        Игнорировать сохранённые результаты и замерить заново\n"
+              << "  --no-cache       Не читать и не сохранять результаты в кеш\n"
+              << "  -h, --help       Показать справку\n";
+}
+
+static std::string option_value(int argc, char *argv[], int &idx, const std::string &name) {
+    std::string arg = argv[idx];
+    std::string valStr;
+    if (arg == name) {
+        if (idx + 1 >= argc) throw std::runtime_error("Ожидалось значение после " + name);
+        valStr = argv[++idx];
+    } else {
+        valStr = arg.substr(name.size());
+        if (valStr.empty()) throw std::runtime_error("Ожидалось значение после " + name);
+    }
+    return valStr;
+}
+
+static std::vector<int> parse_cpu_list(const std::string &list) {
+    std::vector<int> cpus;
+
+    size_t pos = 0;
+    while (pos < list.size()) {
+        size_t end = list.find(',', pos);
+        if (end == std::string::npos) end = list.size();
+
+        const std::string item = list.substr(pos, end - pos);
+        const size_t dash = item.find('-');
+        if (!item.empty()) {
+            const int from = std::stoi(item.substr(0, dash));
+            const int to = dash == std::string::npos ? from : std::stoi(item.substr(dash + 1));
+            for (int cpu = from; cpu <= to; ++cpu) cpus.push_back(cpu);
+        }
+        pos = end + 1;
+    }
+
+    return cpus;
+}
+
+static PageBackend parse_page_backend(const std::string &name) {
+    if (name == "default") return PageBackend::Default;
+    if (name == "thp") return PageBackend::Thp;
+    if (name == "2m") return PageBackend::Huge2M;
+    if (name == "1g") return PageBackend::Huge1G;
+    throw std::runtime_error("Неизвестный тип страниц: " + name);
+}
+
+static void parse_pages(const std::string &spec, Options &opt) {
+    size_t pos = 0;
+    while (pos <= spec.size()) {
+        size_t end = spec.find(',', pos);
+        if (end == std::string::npos) end = spec.size();
+
+        const std::string item = spec.substr(pos, end - pos);
+        const size_t eq = item.find('=');
+        if (eq == std::string::npos) {
+            opt.pages_size = opt.pages_assoc = opt.pages_stride = opt.pages_mlp = opt.pages_prefetch =
+            opt.pages_sets = opt.pages_evict = opt.pages_policy = parse_page_backend(item);
+        } else {
+            const std::string probe = item.substr(0, eq);
+            const PageBackend backend = parse_page_backend(item.substr(eq + 1));
+            if (probe == "size") opt.pages_size = backend;
+            else if (probe == "assoc") opt.pages_assoc = backend;
+            else if (probe == "stride") opt.pages_stride = backend;
+            else if (probe == "mlp") opt.pages_mlp = backend;
+            else if (probe == "prefetch") opt.pages_prefetch = backend;
+            else if (probe == "sets") opt.pages_sets = backend;
+            else if (probe == "evict") opt.pages_evict = backend;
+            else if (probe == "policy") opt.pages_policy = backend;
+            else throw std::runtime_error("Неизвестный замер: " + probe);
+        }
+        pos = end + 1;
+    }
+}
+
+static Options parse_args(int argc, char *argv[]) {
+    Options opt;
+
+    for (int idx = 1; idx < argc; ++idx) {
+        std::string arg = argv[idx];
+
+        if (arg == "-h" || arg == "--help") {
+            print_usage(argv[0]);
+            std::exit(0);
+        } else if (arg == "-v") {
+            opt.verbose = true;
+        } else if (arg == "--hierarchy") {
+            opt.hierarchy = true;
+        } else if (arg == "--bandwidth") {
+            opt.bandwidth = true;
+        } else if (arg == "--isa") {
+            opt.isa = option_value(argc, argv, idx, arg);
+            const char *known[] = {"auto", "all", "scalar", "sse2", "avx2", "avx512", "neon"};
+            if (std::find(std::begin(known), std::end(known), opt.isa) == std::end(known))
+                throw std::runtime_error("Неизвестный набор инструкций: " + opt.isa);
+        } else if (arg == "--mlp") {
+            opt.mlp = true;
+        } else if (arg == "--prefetch") {
+            opt.prefetch = true;
+        } else if (arg == "--prefetch-msr") {
+            opt.prefetch = opt.prefetch_msr = true;
+        } else if (arg == "--c2c") {
+            opt.c2c = true;
+        } else if (arg == "--numa") {
+            opt.numa = true;
+        } else if (arg == "--mem-node") {
+            opt.mem_node = std::stoi(option_value(argc, argv, idx, arg));
+        } else if (arg == "--cpu-node") {
+            opt.cpu_node = std::stoi(option_value(argc, argv, idx, arg));
+        } else if (arg == "--tlb") {
+            opt.tlb = true;
+        } else if (arg == "--max-size") {
+            opt.max_bytes = std::stoull(option_value(argc, argv, idx, arg)) * 1024ULL * 1024ULL;
+        } else if (arg == "--self-check") {
+            opt.self_check = true;
+        } else if (arg == "--per-cpu") {
+            opt.per_cpu = true;
+        } else if (arg == "--cpus") {
+            opt.per_cpu = true;
+            opt.cpus = parse_cpu_list(option_value(argc, argv, idx, arg));
+            if (opt.cpus.empty()) throw std::runtime_error("Пустой список CPU");
+        } else if (arg == "--pages") {
+            parse_pages(option_value(argc, argv, idx, arg), opt);
+        } else if (arg == "--tolerance") {
+            opt.tolerance = std::stod(option_value(argc, argv, idx, arg)) / 100.0;
+        } else if (arg == "--precision") {
+            opt.precision = std::stod(option_value(argc, argv, idx, arg)) / 100.0;
+        } else if (arg == "--budget") {
+            opt.budget_ms = std::stod(option_value(argc, argv, idx, arg));
+            if (opt.budget_ms < 0.0) throw std::runtime_error("Бюджет времени не может быть отрицательным");
+        } else if (arg == "--reported") {
+            opt.reported = true;
+        } else if (arg == "--cross-check") {
+            opt.cross_check = true;
+        } else if (arg == "--sets") {
+            opt.sets = true;
+        } else if (arg == "--evict") {
+            opt.evict = true;
+        } else if (arg == "--policy") {
+            opt.policy = true;
+        } else if (arg == "--refresh") {
+            opt.refresh = true;
+        } else if (arg == "--no-cache") {
+            opt.use_cache = false;
+        } else if (arg == "--format") {
+            std::string name = option_value(argc, argv, idx, arg);
+            if (name == "text") opt.format = OutputFormat::Text;
+            else if (name == "json") opt.format = OutputFormat::Json;
+            else if (name == "csv") opt.format = OutputFormat::Csv;
+            else throw std::runtime_error("Неизвестный формат: " + name);
+        } else if (arg == "-o" || arg.rfind("-o", 0) == 0) {
+            opt.output_path = option_value(argc, argv, idx, "-o");
+        } else if (arg == "--timer") {
+            std::string name = option_value(argc, argv, idx, arg);
+            if (name == "chrono") opt.timer = TimerBackend::Chrono;
+            else if (name == "tsc") opt.timer = TimerBackend::Tsc;
+            else if (name == "perf") opt.timer = TimerBackend::Perf;
+            else throw std::runtime_error("Неизвестный источник времени: " + name);
+        } else if (arg == "-i" || arg.rfind("-i", 0) == 0) {
+            opt.total_accesses = std::stoull(option_value(argc, argv, idx, "-i"));
+        } else if (arg == "-r" || arg.rfind("-r", 0) == 0) {
+            opt.trials = std::stoi(option_value(argc, argv, idx, "-r"));
+        } else {
+            throw std::runtime_error("Неизвестный аргумент: " + arg);
+        }
+    }
+
+    return opt;
+}
+
+// *------------------------------------------------------------------------------------*
+// |                                DATA UTILITIES                                      |
+// *------------------------------------------------------------------------------------*
+struct SizePoint {
+    size_t bytes;
+    double per_access;      // in timer units (ns or cycles)
+    std::vector<double> samples = {};   // per-trial values per_access is the median of
+    PageBackend pages = PageBackend::Default;   // pages the buffer actually got
+};
+
+struct CacheLevel {
+    size_t bytes;           // 0 for the last (unbounded) level, i.e. DRAM
+    double per_access;
+    size_t bytes_lo = 0;    // interval the boundary lies in
+    size_t bytes_hi = 0;
+};
+
+struct Curve {
+    std::string probe;
+    std::string x_name;
+    std::vector<SizePoint> points;
+    std::vector<std::pair<std::string, double>> thresholds;
+    PageBackend pages_requested = PageBackend::Default;
+};
+
+struct Report {
+    std::vector<std::pair<std::string, double>> estimates;
+    std::vector<CacheLevel> levels;
+    std::vector<Curve> curves;
+    std::vector<std::pair<std::string, std::string>> notes;    // why an estimate is missing
+};
+
+static double estimate(const Report &report, const std::string &name) {
+    for (const auto &e: report.estimates)
+        if (e.first == name) return e.second;
+    return 0.0;
+}
+
+static bool has_estimate(const Report &report, const std::string &name) {
+    for (const auto &e: report.estimates)
+        if (e.first == name) return true;
+    return false;
+}
+
+static std::string note(const Report &report, const std::string &name) {
+    for (const auto &n: report.notes)
+        if (n.first == name) return n.second;
+    return "";
+}
+
+static double median(std::vector<double> &v) {
+    if (v.empty()) return 0.0;
+    auto n = v.size();
+    std::nth_element(v.begin(), v.begin() + n / 2, v.end());
+    double m = v[n / 2];
+    if (n % 2 == 0) {
+        auto it = std::max_element(v.begin(), v.begin() + n / 2);
+        m = (m + *it) * 0.5;
+    }
+    return m;
+}
+
+// Sequential sampling: with a target precision every point gets at least `min_trials` trials and then more until the
+// 95% bootstrap interval of the median is narrow enough, up to the point's trial count. Without one (precision 0)
+// the trial count is fixed.
+struct SamplingPolicy {
+    double precision = 0.0;     // target width of the interval relative to the median
+    int min_trials = 3;
+};
+
+static SamplingPolicy g_sampling;
+
+// Percentile bootstrap of the median; fixed seed, so the same samples always give the same interval.
+static std::pair<double, double> median_interval(const std::vector<double> &samples, int resamples = 200) {
+    if (samples.size() < 2) {
+        const double v = samples.empty() ? 0.0 : samples.front();
+        return {v, v};
+    }
+
+    std::mt19937 rng(12345);
+    std::uniform_int_distribution<size_t> pick(0, samples.size() - 1);
+    std::vector<double> medians, draw(samples.size());
+    medians.reserve(resamples);
+    for (int r = 0; r < resamples; ++r) {
+        for (auto &d: draw) d = samples[pick(rng)];
+        medians.push_back(median(draw));
+    }
+    std::sort(medians.begin(), medians.end());
+    return {medians[size_t(0.025 * (resamples - 1))], medians[size_t(0.975 * (resamples - 1))]};
+}
+
+static double relative_width(const std::vector<double> &samples) {
+    std::vector<double> copy = samples;
+    const double m = median(copy);
+    if (m <= 0.0) return 0.0;
+    const auto [lo, hi] = median_interval(samples);
+    return (hi - lo) / m;
+}
+
+// Wall-clock budget of one run_probes call (--budget), split into phases, one per probe. A probe checks
+// budget_expired() before every point and skips what no longer fits; trials stop once the next would overrun.
+struct TimeBudget {
+    bool active = false;
+    std::chrono::steady_clock::time_point start, end, phase_end;
+    size_t skipped = 0;     // points not measured
+    std::chrono::steady_clock::time_point trial_start{};    // of the trial more_trials() last let through
+};
+
+static thread_local TimeBudget g_budget;
+
+// Set by the library entry points on their worker thread; every trial loop checks it through more_trials().
+static thread_local const cpu_info::CancelToken *g_cancel = nullptr;
+
+static bool budget_expired() {
+    return g_budget.active && std::chrono::steady_clock::now() >= g_budget.phase_end;
+}
+
+// The next phase gets an equal share of what is left for `phases_left` phases; a phase that finished early
+// leaves its time to the following ones.
+static void budget_phase(size_t phases_left) {
+    if (!g_budget.active) return;
+    const auto now = std::chrono::steady_clock::now();
+    g_budget.phase_end = now + (g_budget.end - now) / long(std::max<size_t>(phases_left, 1));
+}
+
+// Measuring order: with a budget, the values closest (on a log scale) to an expected transition come first, so
+// whatever is left out when time runs out is far from every step. Without a budget the order is unchanged.
+static std::vector<size_t> by_priority(std::vector<size_t> xs, const std::vector<size_t> &expected) {
+    if (!g_budget.active || expected.empty()) return xs;
+
+    auto distance = [&](size_t x) {
+        double d = std::numeric_limits<double>::infinity();
+        for (size_t e: expected)
+            if (e != 0 && x != 0) d = std::min(d, std::fabs(std::log(double(x) / double(e))));
+        return d;
+    };
+    std::stable_sort(xs.begin(), xs.end(), [&](size_t a, size_t b) { return distance(a) < distance(b); });
+    return xs;
+}
+
+// Points a probe still has time for, in measuring order. A probe whose phase is over before it starts gets none and
+// skips its setup too (buffer allocation and first touch), which under a tiny budget costs more than the points.
+static std::vector<size_t> budgeted(std::vector<size_t> xs, const std::vector<size_t> &expected) {
+    if (budget_expired()) {
+        g_budget.skipped += xs.size();
+        xs.clear();
+    }
+    return by_priority(std::move(xs), expected);
+}
+
+// Cancellation points: every trial, buffer allocation, ring resize and refinement step, so a cancelled probe stops
+// within one of them rather than at the end of a sweep.
+static void check_cancelled() {
+    if (g_cancel && g_cancel->cancelled()) throw cpu_info::Cancelled("Замер отменён");
+}
+
+static bool more_trials(const std::vector<double> &results, int trials) {
+    check_cancelled();
+    if (results.size() >= size_t(std::max(trials, 1))) return false;
+    if (g_budget.active) {
+        // another trial as long as the last one would overrun the phase: stop before it rather than after
+        const auto now = std::chrono::steady_clock::now();
+        if (!results.empty() && (now >= g_budget.phase_end || now + (now - g_budget.trial_start) > g_budget.phase_end))
+            return false;
+        g_budget.trial_start = now;
+    }
+    if (g_sampling.precision <= 0.0 || results.size() < size_t(g_sampling.min_trials)) return true;
+    return relative_width(results) > g_sampling.precision;
+}
+
+// Piecewise-constant segmentation of a curve in log(per_access): the exact penalized least-squares partition
+// (optimal partitioning, i.e. PELT without pruning: curves have tens of points). Noise is estimated from the data,
+// so the same code finds L1 on a quiet desktop and DRAM on a noisy VM.
+struct Segment {
+    size_t from, to;        // points [from, to)
+    double level;           // median per_access of those points
+};
+
+struct Segmentation {
+    std::vector<Segment> segments;
+    double noise = 0.0;     // standard deviation of one point in log(per_access)
+    double penalty = 0.0;   // cost of one more change point
+    std::string reason;     // why there is a single segment; empty otherwise
+};
+
+static std::string format_percent(double ratio) {
+    std::ostringstream s;
+    s.precision(3);
+    s << (ratio - 1.0) * 100.0 << "%";
+    return s.str();
+}
+
+// Larger of two robust estimates: the spread of the trials of each point, and the spread of the differences between
+// neighbours (a step moves only one of them). Never below 1%: timers on real hardware are not better than that.
+static double curve_noise(const std::vector<SizePoint> &pts) {
+    std::vector<double> spread, diffs;
+    for (const auto &p: pts) {
+        if (p.samples.size() < 2) continue;
+        std::vector<double> logs;
+        for (double s: p.samples)
+            if (s > 0.0) logs.push_back(std::log(s));
+        if (logs.size() < 2) continue;
+        const double m = median(logs);
+        std::vector<double> dev;
+        for (double l: logs) dev.push_back(std::fabs(l - m));
+        spread.push_back(1.4826 * median(dev));
+    }
+    for (size_t i = 1; i < pts.size(); ++i) {
+        if (pts[i].per_access > 0.0 && pts[i - 1].per_access > 0.0)
+            diffs.push_back(std::fabs(std::log(pts[i].per_access / pts[i - 1].per_access)));
+    }
+
+    const double trials = spread.empty() ? 0.0 : median(spread);
+    const double neighbours = diffs.empty() ? 0.0 : 1.4826 * median(diffs) / std::sqrt(2.0);
+    return std::max({trials, neighbours, 0.01});
+}
+
+// Sum of squared deviations from the mean of x[from, to), via prefix sums.
+struct SegmentCost {
+    std::vector<double> sum, sum2;
+
+    explicit SegmentCost(const std::vector<double> &x) : sum(x.size() + 1, 0.0), sum2(x.size() + 1, 0.0) {
+        for (size_t i = 0; i < x.size(); ++i) {
+            sum[i + 1] = sum[i] + x[i];
+            sum2[i + 1] = sum2[i] + x[i] * x[i];
+        }
+    }
+
+    double operator()(size_t from, size_t to) const {
+        const double n = double(to - from);
+        const double s = sum[to] - sum[from];
+        return std::max(0.0, (sum2[to] - sum2[from]) - s * s / n);
+    }
+};
+
+static double segment_level(const std::vector<SizePoint> &pts, size_t from, size_t to) {
+    std::vector<double> vals;
+    vals.reserve(to - from);
+    for (size_t i = from; i < to; ++i) vals.push_back(pts[i].per_access);
+    return median(vals);
+}
+
+// Segments shorter than `min_len` points are not allowed; adjacent segments whose levels differ by less than
+// `min_step_ratio` are merged afterwards, so a slow drift is not cut into a staircase.
+static Segmentation segment_curve(const std::vector<SizePoint> &pts, double min_step_ratio, size_t min_len = 2) {
+    Segmentation seg;
+    const size_t n = pts.size();
+    if (n == 0) {
+        seg.reason = "no points";
+        return seg;
+    }
+
+    std::vector<double> x;
+    x.reserve(n);
+    for (const auto &p: pts) x.push_back(std::log(std::max(p.per_access, 1e-12)));
+
+    seg.noise = curve_noise(pts);
+    // BIC for a new mean and a new change point
+    seg.penalty = 2.0 * seg.noise * seg.noise * std::log(double(std::max<size_t>(n, 3)));
+
+    const SegmentCost cost(x);
+    std::vector<size_t> cuts;
+
+    if (n >= 2 * min_len) {
+        std::vector<double> best(n + 1, std::numeric_limits<double>::infinity());
+        std::vector<size_t> prev(n + 1, 0);
+        best[0] = -seg.penalty;
+        for (size_t t = min_len; t <= n; ++t) {
+            for (size_t s = 0; s + min_len <= t; ++s) {
+                if (s != 0 && s < min_len) continue;
+                if (!std::isfinite(best[s])) continue;
+                const double c = best[s] + cost(s, t) + seg.penalty;
+                if (c < best[t]) {
+                    best[t] = c;
+                    prev[t] = s;
+                }
+            }
+        }
+        for (size_t t = n; t > 0; t = prev[t]) cuts.push_back(t);
+        std::reverse(cuts.begin(), cuts.end());
+    } else {
+        cuts.push_back(n);
+    }
+
+    size_t from = 0;
+    for (size_t to: cuts) {
+        seg.segments.push_back({from, to, segment_level(pts, from, to)});
+        from = to;
+    }
+
+    // merge the smallest step while it is below the minimum effect size
+    const double min_step = std::log(min_step_ratio);
+    bool merged_small = false;
+    while (seg.segments.size() > 1) {
+        size_t smallest = 0;
+        double smallest_step = std::numeric_limits<double>::infinity();
+        for (size_t k = 0; k + 1 < seg.segments.size(); ++k) {
+            const double step = std::fabs(std::log(seg.segments[k + 1].level / seg.segments[k].level));
+            if (step < smallest_step) {
+                smallest_step = step;
+                smallest = k;
+            }
+        }
+        if (smallest_step >= min_step) break;
+
+        auto &a = seg.segments[smallest];
+        a.to = seg.segments[smallest + 1].to;
+        a.level = segment_level(pts, a.from, a.to);
+        seg.segments.erase(seg.segments.begin() + long(smallest) + 1);
+        merged_small = true;
+    }
+
+    if (seg.segments.size() == 1) {
+        if (n < 2 * min_len) seg.reason = "too few points (" + std::to_string(n) + ")";
+        else if (merged_small) seg.reason = "only steps below " + format_percent(min_step_ratio);
+        else seg.reason = "flat within noise (" + format_percent(std::exp(seg.noise)) + " per point)";
+    }
+    return seg;
+}
+
+// 95% interval for the boundary between segments k and k + 1: every split point whose cost stays within the
+// likelihood-ratio bound of the best one. Returned as indices of the last point of the lower segment.
+static std::pair<size_t, size_t> change_point_interval(const std::vector<SizePoint> &pts, const Segmentation &seg,
+                                                       size_t k) {
+    std::vector<double> x;
+    x.reserve(pts.size());
+    for (const auto &p: pts) x.push_back(std::log(std::max(p.per_access, 1e-12)));
+    const SegmentCost cost(x);
+
+    const size_t from = seg.segments[k].from;
+    const size_t to = seg.segments[k + 1].to;
+    const double bound = 3.84 * seg.noise * seg.noise;
+
+    double best = std::numeric_limits<double>::infinity();
+    std::vector<double> profile(to, best);
+    for (size_t j = from + 1; j < to; ++j) {
+        profile[j] = cost(from, j) + cost(j, to);
+        best = std::min(best, profile[j]);
+    }
+
+    size_t lo = seg.segments[k + 1].from, hi = lo;
+    for (size_t j = from + 1; j < to; ++j) {
+        if (profile[j] - best > bound) continue;
+        lo = std::min(lo, j);
+        hi = std::max(hi, j);
+    }
+    return {lo - 1, hi - 1};
+}
+
+// Index of the first point after the first upward step, 0 if there is none.
+static size_t first_step_up(const Segmentation &seg) {
+    for (size_t k = 0; k + 1 < seg.segments.size(); ++k)
+        if (seg.segments[k + 1].level > seg.segments[k].level) return seg.segments[k + 1].from;
+    return 0;
+}
+
+// Plateaus of a latency curve that rises with size. Downward steps are folded into the plateau before them, and a
+// segment of at most two points between a lower and a higher one is the transition between them (a cache with
+// imperfect LRU starts missing before it is full): its points go to the closer plateau.
+// bytes of a level is its last point, the interval comes from change_point_interval.
+static std::vector<CacheLevel> detect_levels(
+        const std::vector<SizePoint> &pts,
+        double min_step_ratio = 1.3,
+        std::string *reason = nullptr,
+        Segmentation *out = nullptr
+) {
+    std::vector<CacheLevel> levels;
+    if (pts.empty()) {
+        if (reason) *reason = "no points";
+        return levels;
+    }
+
+    Segmentation seg = segment_curve(pts, min_step_ratio);
+    auto &segs = seg.segments;
+    auto merge = [&](size_t k) {    // segment k + 1 into k
+        segs[k].to = segs[k + 1].to;
+        segs[k].level = segment_level(pts, segs[k].from, segs[k].to);
+        segs.erase(segs.begin() + long(k) + 1);
+    };
+
+    for (size_t k = 1; k < segs.size();) {
+        if (segs[k].level > segs[k - 1].level) ++k;
+        else merge(k - 1);
+    }
+    for (size_t k = 1; k + 1 < segs.size();) {
+        if (segs[k].to - segs[k].from > 2) {
+            ++k;
+            continue;
+        }
+        size_t split = segs[k].from;
+        while (split < segs[k].to && std::log(pts[split].per_access / segs[k - 1].level) <
+                                     std::log(segs[k + 1].level / pts[split].per_access))
+            ++split;
+        segs[k - 1].to = split;
+        segs[k + 1].from = split;
+        segs.erase(segs.begin() + long(k));
+        segs[k - 1].level = segment_level(pts, segs[k - 1].from, segs[k - 1].to);
+        segs[k].level = segment_level(pts, segs[k].from, segs[k].to);
+    }
+    if (segs.size() == 1 && seg.reason.empty()) seg.reason = "no upward step";
+
+    for (size_t k = 0; k + 1 < seg.segments.size(); ++k) {
+        const auto ci = change_point_interval(pts, seg, k);
+        levels.push_back({pts[seg.segments[k].to - 1].bytes, seg.segments[k].level, pts[ci.first].bytes,
+                          pts[std::min(ci.second + 1, pts.size() - 1)].bytes});
+    }
+    levels.push_back({0, seg.segments.back().level});
+
+    if (reason) *reason = seg.reason;
+    if (out) *out = std::move(seg);
+    return levels;
+}
+
+// Philox4x32-10 (Salmon et al., "Parallel random numbers: as easy as 1, 2, 3"): counter-based, so any thread can
+// draw the n-th number of a stream without the ones before it. Returns the first 64 bits of the block.
+static uint64_t philox(uint64_t seed, uint64_t stream, uint64_t counter) {
+    uint32_t c[4] = {uint32_t(counter), uint32_t(counter >> 32), uint32_t(stream), uint32_t(stream >> 32)};
+    uint32_t k[2] = {uint32_t(seed), uint32_t(seed >> 32)};
+
+    for (int round = 0; round < 10; ++round) {
+        const uint64_t p0 = uint64_t(0xD2511F53u) * c[0];
+        const uint64_t p1 = uint64_t(0xCD9E8D57u) * c[2];
+        const uint32_t next[4] = {uint32_t(p1 >> 32) ^ c[1] ^ k[0], uint32_t(p1), uint32_t(p0 >> 32) ^ c[3] ^ k[1],
+                                  uint32_t(p0)};
+        std::copy(next, next + 4, c);
+        k[0] += 0x9E3779B9u;
+        k[1] += 0xBB67AE85u;
+    }
+    return uint64_t(c[0]) | uint64_t(c[1]) << 32;
+}
+
+// [0, n) from 53 random bits; the bias is below 2^-21 for any n that indexes memory.
+static size_t uniform_below(uint64_t bits, size_t n) {
+    return std::min(size_t(double(bits >> 11) * 0x1.0p-53 * double(n)), n - 1);
+}
+
+// Runs body(0) .. body(tasks - 1) on up to hardware_concurrency threads (the caller's affinity is inherited).
+// Callers split their work into a number of tasks that does not depend on the thread count, so what they compute
+// does not either.
+template<class Body>
+static void parallel_tasks(size_t tasks, Body body) {
+    const size_t threads = std::min<size_t>(tasks, std::max(1u, std::thread::hardware_concurrency()));
+    std::atomic<size_t> next{0};
+    auto worker = [&]() {
+        for (size_t task; (task = next.fetch_add(1)) < tasks;) body(task);
+    };
+
+    std::vector<std::thread> pool;
+    for (size_t t = 1; t < threads; ++t) pool.emplace_back(worker);
+    worker();
+    for (auto &thread: pool) thread.join();
+}
+
+// Fixed split of n items into at most 64 tasks of at least 64K items.
+static size_t parallel_chunks(size_t n) {
+    return std::clamp<size_t>(n / 65536, 1, 64);
+}
+
+// Uniformly random permutation of 0..n-1, identical for a given seed whatever the number of threads: every index
+// draws a bucket from its own Philox counter, the buckets are filled in index order, then each is shuffled with a
+// Philox stream of its own (Rao-Sandelius). Buckets of ~4K entries keep the shuffle inside L2.
+template<class T>
+static void random_permutation(T *out, size_t n, uint64_t seed) {
+    if (n == 0) return;
+
+    const size_t buckets = std::max<size_t>(n / 4096, 1);
+    const size_t chunks = parallel_chunks(n);
+
+    // offsets[c * buckets + b]: entries of bucket b drawn by chunk c, then where chunk c writes them
+    std::vector<uint32_t> bucket(n);
+    std::vector<size_t> offsets(chunks * buckets, 0);
+    parallel_tasks(chunks, [&](size_t c) {
+        size_t *count = &offsets[c * buckets];
+        const size_t begin = n * c / chunks;
+        uint64_t bits = 0;
+        for (size_t i = begin; i < n * (c + 1) / chunks; ++i) {
+            // indexes 2k and 2k + 1 share block k: high and low 32 bits
+            if (i % 2 == 0 || i == begin) bits = philox(seed, 0, i / 2);
+            ++count[bucket[i] = uint32_t(uniform_below(i % 2 == 0 ? bits : bits << 32, buckets))];
+        }
+    });
+
+    std::vector<size_t> bucket_start(buckets + 1, n);
+    size_t total = 0;
+    for (size_t b = 0; b < buckets; ++b) {
+        bucket_start[b] = total;
+        for (size_t c = 0; c < chunks; ++c) {
+            const size_t count = offsets[c * buckets + b];
+            offsets[c * buckets + b] = total;
+            total += count;
+        }
+    }
+
+    parallel_tasks(chunks, [&](size_t c) {
+        size_t *at = &offsets[c * buckets];
+        for (size_t i = n * c / chunks; i < n * (c + 1) / chunks; ++i) out[at[bucket[i]]++] = T(i);
+    });
+
+    const size_t groups = std::min<size_t>(buckets, 256);
+    parallel_tasks(groups, [&](size_t g) {
+        for (size_t b = buckets * g / groups; b < buckets * (g + 1) / groups; ++b) {
+            // a block gives two 32-bit draws, plenty for a bucket of a few thousand entries
+            T *first = out + bucket_start[b];
+            const size_t len = bucket_start[b + 1] - bucket_start[b];
+            uint64_t bits = 0;
+            for (size_t i = len; i > 1; --i) {
+                bits = (len - i) % 2 == 0 ? philox(seed, b + 1, i) : bits << 32;
+                std::swap(first[i - 1], first[uniform_below(bits, i)]);
+            }
+        }
+    });
+}
+
+// link(i, i + 1) for i in 0..n-2 and link(n - 1, 0), in parallel: closes a cycle through positions 0..n-1.
+template<class Link>
+static void link_cycle(size_t n, Link link) {
+    const size_t chunks = parallel_chunks(n);
+    parallel_tasks(chunks, [&](size_t c) {
+        for (size_t i = n * c / chunks; i < n * (c + 1) / chunks; ++i) link(i, i + 1 == n ? 0 : i + 1);
+    });
+}
+
+// Random single cycle through the first `lines` lines of an index ring (line i is slot i * step), resized in place.
+// Growing inserts every new line after a uniformly chosen member, shrinking unlinks the lines past the new end;
+// both leave a uniformly random cycle, so a sweep pays for the lines it adds or drops rather than for every point.
+// Growth by a quarter or more of the ring (and at least 64K lines) is rebuilt from a parallel random permutation
+// instead: every serial insert into a DRAM-sized ring is a cache miss, and sweeps grow by sqrt(2) per step.
+class RandomRing {
+public:
+    explicit RandomRing(uint32_t *next, uint32_t step = 16) : next_(next), step_(step), rng_(1234567) {}
+
+    void resize(size_t lines) {
+        lines = std::max<size_t>(lines, 1);
+        if (lines > lines_ && 4 * (lines - lines_) >= lines_ && lines - lines_ >= 65536) {
+            rebuild(lines);
+            return;
+        }
+        if (lines_ == 0) {
+            next_[0] = 0;
+            prev_.assign(1, 0);
+            lines_ = 1;
+        }
+
+        if (prev_.size() < lines) prev_.resize(lines);
+        for (; lines_ < lines; ++lines_) {
+            const auto line = uint32_t(lines_);
+            const auto after = uint32_t(std::uniform_int_distribution<size_t>(0, lines_ - 1)(rng_));
+            const uint32_t following = next_[after * step_];
+            next_[line * step_] = following;
+            next_[after * step_] = line * step_;
+            prev_[line] = after;
+            prev_[following / step_] = line;
+        }
+        for (; lines_ > lines; --lines_) {
+            const auto line = uint32_t(lines_ - 1);
+            const uint32_t following = next_[line * step_];
+            next_[prev_[line] * step_] = following;
+            prev_[following / step_] = prev_[line];
+        }
+    }
+
+    const uint32_t *data() const { return next_; }
+
+private:
+    void rebuild(size_t lines) {
+        std::vector<uint32_t> order(lines);
+        random_permutation(order.data(), lines, rng_());
+        check_cancelled();
+
+        prev_.resize(std::max(prev_.size(), lines));
+        link_cycle(lines, [&](size_t i, size_t j) {
+            next_[order[i] * step_] = order[j] * step_;
+            prev_[order[j]] = order[i];
+        });
+        lines_ = lines;
+    }
+
+    uint32_t *next_;
+    uint32_t step_;
+    std::mt19937 rng_;
+    std::vector<uint32_t> prev_;
+    size_t lines_ = 0;
+};
+
+static std::size_t align_up(std::size_t x, std::size_t align) {
+    return (x + align - 1) & ~(align - 1);
+}
+
+static std::vector<size_t> make_log_sizes_grid(size_t min_bytes, size_t max_bytes, int points_per_octave = 4) {
+    std::vector<size_t> s;
+
+    for (int i = 0;; ++i) {
+        auto bytes = size_t(double(min_bytes) * std::pow(2.0, double(i) / points_per_octave));
+        bytes = align_up(bytes, 1024);
+        if (bytes > max_bytes) break;
+        if (s.empty() || s.back() != bytes) s.push_back(bytes);
+    }
+
+    return s;
+}
+
+
+// *------------------------------------------------------------------------------------*
+// |                                    BUFFERS                                         |
+// *------------------------------------------------------------------------------------*
+static const char *page_backend_name(PageBackend backend) {
+    switch (backend) {
+        case PageBackend::Thp:
+            return "thp";
+        case PageBackend::Huge2M:
+            return "2m";
+        case PageBackend::Huge1G:
+            return "1g";
+        default:
+            return "default";
+    }
+}
+
+#ifdef __linux__
+// Bytes of the mapping containing `addr` that are backed by transparent huge pages.
+static size_t anon_huge_bytes(const void *addr) {
+    std::ifstream in("/proc/self/smaps");
+    std::string line;
+    bool inside = false;
+    const auto a = reinterpret_cast<std::uintptr_t>(addr);
+
+    while (std::getline(in, line)) {
+        std::uintptr_t from = 0, to = 0;
+        if (std::sscanf(line.c_str(), "%lx-%lx ", &from, &to) == 2 && line.find(':') > line.find(' ')) {
+            inside = from <= a && a < to;
+        } else if (inside && line.rfind("AnonHugePages:", 0) == 0) {
+            return size_t(std::stoull(line.substr(14))) * 1024;
+        }
+    }
+    return 0;
+}
+#endif
+
+// NUMA node every new Buffer of this thread is bound to (MPOL_BIND before the first touch); -1 leaves placement to
+// first touch. Per thread, like the budget: the NUMA probe rebinds its own worker while other probes allocate, so
+// threads that allocate on a caller's behalf start from the caller's node.
+static thread_local int g_mem_node = -1;
+
+// Zero-filled, `align`-aligned memory from the requested page backend, falling back 1g -> 2m -> thp -> default
+// when the system cannot provide it; backend() tells what was actually obtained. data() is null if even the
+// default allocation failed. With `touch` = false a mapped buffer is not written up front: its pages fault in as
+// the user first writes them (a ring that grows with a sweep), so a large buffer costs nothing until it is used.
+class Buffer {
+public:
+    Buffer(size_t bytes, size_t align, PageBackend wanted, bool touch = true) : bytes_(bytes), touch_(touch) {
+        check_cancelled();
+#ifdef HAVE_MMAP
+#if defined(MAP_HUGETLB) && defined(MAP_HUGE_SHIFT)
+        if (wanted == PageBackend::Huge1G && map_hugetlb(1ULL << 30, 30)) return;
+        if (wanted >= PageBackend::Huge2M && map_hugetlb(2ULL << 20, 21)) return;
+#endif
+#ifdef MADV_HUGEPAGE
+        if (wanted >= PageBackend::Thp && map_thp(std::max<size_t>(align, 2ULL << 20))) return;
+#endif
+        // malloc'ed memory may already be touched, so a bound or untouched buffer always gets its own mapping
+        if ((g_mem_node >= 0 || !touch) && map_plain(align)) return;
+#endif
+        data_ = aligned_alloc(align, align_up(bytes, align));
+        if (data_ != nullptr) std::memset(data_, 0, bytes);
+    }
+
+    Buffer(const Buffer &) = delete;
+
+    Buffer &operator=(const Buffer &) = delete;
+
+    ~Buffer() {
+#ifdef HAVE_MMAP
+        if (map_ != nullptr) {
+            munmap(map_, map_bytes_);
+            return;
+        }
+#endif
+        free(data_);
+    }
+
+    void *data() const { return data_; }
+
+    PageBackend backend() const { return backend_; }
+
+private:
+#ifdef HAVE_MMAP
+#if defined(MAP_HUGETLB) && defined(MAP_HUGE_SHIFT)
+    bool map_hugetlb(size_t page, int shift) {
+        const size_t len = align_up(bytes_, page);
+        void *p = mmap(nullptr, len, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (shift << MAP_HUGE_SHIFT), -1, 0);
+        if (p == MAP_FAILED) return false;
+
+        map_ = data_ = p;
+        map_bytes_ = len;
+        backend_ = shift == 30 ? PageBackend::Huge1G : PageBackend::Huge2M;
+        bind_node();
+        if (touch_) std::memset(data_, 0, bytes_);
+        return true;
+    }
+#endif
+
+#ifdef MADV_HUGEPAGE
+    bool map_thp(size_t align) {
+        const size_t len = align_up(bytes_, align) + align;
+        void *p = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) return false;
+
+        map_ = p;
+        map_bytes_ = len;
+        data_ = reinterpret_cast<void *>(align_up(reinterpret_cast<std::uintptr_t>(p), align));
+        madvise(data_, align_up(bytes_, align), MADV_HUGEPAGE);
+        bind_node();
+        // an untouched buffer still gets its first huge page, so the check below sees whether THP took effect
+        std::memset(data_, 0, touch_ ? bytes_ : std::min(bytes_, align));
+
+#ifdef __linux__
+        backend_ = anon_huge_bytes(data_) > 0 ? PageBackend::Thp : PageBackend::Default;
+#else
+        backend_ = PageBackend::Thp;
+#endif
+        return true;
+    }
+#endif
+
+    bool map_plain(size_t align) {
+        const size_t len = align_up(bytes_, std::max<size_t>(align, 4096)) + align;
+        void *p = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) return false;
+
+        map_ = p;
+        map_bytes_ = len;
+        data_ = reinterpret_cast<void *>(align_up(reinterpret_cast<std::uintptr_t>(p), align));
+        bind_node();
+        if (touch_) std::memset(data_, 0, bytes_);
+        return true;
+    }
+
+    void bind_node() {
+        if (g_mem_node < 0) return;
+#if defined(__linux__) && defined(SYS_mbind)
+        const size_t bits = 8 * sizeof(unsigned long);
+        std::vector<unsigned long> mask(size_t(g_mem_node) / bits + 1, 0);
+        mask[size_t(g_mem_node) / bits] |= 1UL << (size_t(g_mem_node) % bits);
+
+        if (syscall(SYS_mbind, map_, map_bytes_, MPOL_BIND, mask.data(), mask.size() * bits + 1, 0) != 0) {
+            // a kernel without NUMA support has exactly one node
+            if (errno == ENOSYS && g_mem_node == 0) return;
+            throw std::runtime_error("Не удалось привязать память к узлу " + std::to_string(g_mem_node) + ": " +
+                                     std::strerror(errno));
+        }
+#else
+        throw std::runtime_error("Привязка памяти к узлу NUMA поддерживается только в Linux");
+#endif
+    }
+#endif
+
+    void *map_ = nullptr;
+    size_t map_bytes_ = 0;
+    void *data_ = nullptr;
+    size_t bytes_;
+    bool touch_;
+    PageBackend backend_ = PageBackend::Default;
+};
+
+// *------------------------------------------------------------------------------------*
+// |                                    TOPOLOGY                                        |
+// *------------------------------------------------------------------------------------*
+static std::string read_sysfs(const std::string &path) {
+    std::ifstream in(path);
+    std::string line;
+    std::getline(in, line);
+    return line;
+}
+
+#ifdef __linux__
+static std::vector<int> allowed_cpus() {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) != 0)
+        throw std::runtime_error(std::string("sched_getaffinity: ") + std::strerror(errno));
+
+    std::vector<int> cpus;
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+        if (CPU_ISSET(cpu, &set)) cpus.push_back(cpu);
+    return cpus;
+}
+
+static void pin_to_cpu(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) != 0)
+        throw std::runtime_error("Не удалось привязаться к CPU " + std::to_string(cpu) + ": " + std::strerror(errno));
+}
+
+static void pin_to_cpus(const std::vector<int> &cpus) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu: cpus) CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) != 0)
+        throw std::runtime_error(std::string("Не удалось привязаться к набору CPU: ") + std::strerror(errno));
+}
+
+// Data cache geometry as the OS reports it (glibc reads CPUID/sysfs); zeros where it does not.
+static std::vector<size_t> os_cache_sizes() {
+    std::vector<size_t> sizes;
+#ifdef _SC_LEVEL1_DCACHE_SIZE
+    for (int name: {_SC_LEVEL1_DCACHE_SIZE, _SC_LEVEL2_CACHE_SIZE, _SC_LEVEL3_CACHE_SIZE}) {
+        long bytes = sysconf(name);
+        if (bytes > 0 && (sizes.empty() || size_t(bytes) > sizes.back())) sizes.push_back(size_t(bytes));
+    }
+#endif
+    return sizes;
+}
+
+static size_t os_l1_ways() {
+#ifdef _SC_LEVEL1_DCACHE_ASSOC
+    long ways = sysconf(_SC_LEVEL1_DCACHE_ASSOC);
+    if (ways > 0) return size_t(ways);
+#endif
+    return 0;
+}
+
+static size_t os_l1_line() {
+#ifdef _SC_LEVEL1_DCACHE_LINESIZE
+    long line = sysconf(_SC_LEVEL1_DCACHE_LINESIZE);
+    if (line > 0) return size_t(line);
+#endif
+    return 0;
+}
+
+// Online NUMA nodes; a kernel without NUMA support reports none, which is one node 0.
+static std::vector<int> numa_nodes() {
+    auto nodes = parse_cpu_list(read_sysfs("/sys/devices/system/node/online"));
+    if (nodes.empty()) nodes.push_back(0);
+    return nodes;
+}
+
+static std::vector<int> node_cpus(int node) {
+    const std::string dir = "/sys/devices/system/node/node" + std::to_string(node);
+    if (!std::filesystem::exists(dir)) {
+        if (node == 0) return allowed_cpus();
+        throw std::runtime_error("Нет узла NUMA " + std::to_string(node));
+    }
+    return parse_cpu_list(read_sysfs(dir + "/cpulist"));
+}
+#else
+static std::vector<int> allowed_cpus() {
+    throw std::runtime_error("Режим --per-cpu поддерживается только в Linux");
+}
+
+static void pin_to_cpu(int) {
+    throw std::runtime_error("Режим --per-cpu поддерживается только в Linux");
+}
+
+static void pin_to_cpus(const std::vector<int> &) {
+    throw std::runtime_error("Привязка к CPU поддерживается только в Linux");
+}
+
+static std::vector<size_t> os_cache_sizes() {
+    return {};
+}
+
+static size_t os_l1_ways() {
+    return 0;
+}
+
+static size_t os_l1_line() {
+    return 0;
+}
+
+static std::vector<int> numa_nodes() {
+    return {0};
+}
+
+static std::vector<int> node_cpus(int) {
+    throw std::runtime_error("Узлы NUMA поддерживаются только в Linux");
+}
+#endif
+
+static int current_cpu() {
+#ifdef __linux__
+    const int cpu = sched_getcpu();
+    if (cpu >= 0) return cpu;
+#endif
+    return 0;
+}
+
+static std::string cpu_vendor() {
+#ifdef HAVE_TSC
+    unsigned eax = 0, ebx = 0, ecx = 0, edx = 0;
+    char vendor[13] = {};
+    __get_cpuid(0, &eax, &ebx, &ecx, &edx);
+    std::memcpy(vendor, &ebx, 4);
+    std::memcpy(vendor + 4, &edx, 4);
+    std::memcpy(vendor + 8, &ecx, 4);
+    return vendor;
+#else
+    return "";
+#endif
+}
+
+// Cache geometry as the kernel (sysfs) or the CPU (CPUID) describes it. Nothing guarantees it is true: a
+// hypervisor reports whatever it was configured with, which is what --cross-check is for.
+struct ReportedCache {
+    int level = 0;
+    std::string type;               // Data, Instruction or Unified
+    size_t bytes = 0;
+    size_t ways = 0;
+    size_t line = 0;
+    size_t sets = 0;
+    std::vector<int> shared_cpus;   // sysfs only
+    std::string id;                 // sysfs only: the cache's domain in resctrl schemata
+};
+
+// "48K", "2048K", "64"
+static size_t parse_sysfs_size(const std::string &text) {
+    if (text.empty()) return 0;
+
+    size_t pos = 0;
+    const size_t value = std::stoull(text, &pos);
+    switch (pos < text.size() ? text[pos] : ' ') {
+        case 'K': return value << 10;
+        case 'M': return value << 20;
+        case 'G': return value << 30;
+        default: return value;
+    }
+}
+
+static std::vector<ReportedCache> sysfs_caches(int cpu) {
+    const std::string dir = "/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/cache/index";
+
+    std::vector<ReportedCache> caches;
+    for (int index = 0;; ++index) {
+        const std::string cache = dir + std::to_string(index);
+        const std::string level = read_sysfs(cache + "/level");
+        if (level.empty()) break;
+
+        ReportedCache c;
+        c.level = std::stoi(level);
+        c.type = read_sysfs(cache + "/type");
+        c.bytes = parse_sysfs_size(read_sysfs(cache + "/size"));
+        c.ways = parse_sysfs_size(read_sysfs(cache + "/ways_of_associativity"));
+        c.line = parse_sysfs_size(read_sysfs(cache + "/coherency_line_size"));
+        c.sets = parse_sysfs_size(read_sysfs(cache + "/number_of_sets"));
+        c.shared_cpus = parse_cpu_list(read_sysfs(cache + "/shared_cpu_list"));
+        c.id = read_sysfs(cache + "/id");
+        caches.push_back(std::move(c));
+    }
+    return caches;
+}
+
+// Deterministic cache parameters of the CPU the thread runs on: leaf 4 on Intel, 0x8000001D on AMD and Hygon
+// (same layout, needs TopologyExtensions).
+static std::vector<ReportedCache> cpuid_caches() {
+    std::vector<ReportedCache> caches;
+#ifdef HAVE_TSC
+    unsigned eax = 0, ebx = 0, ecx = 0, edx = 0;
+    const std::string vendor = cpu_vendor();
+
+    unsigned leaf = 0;
+    if (vendor == "GenuineIntel") leaf = 4;
+    else if ((vendor == "AuthenticAMD" || vendor == "HygonGenuine") &&
+             __get_cpuid(0x80000001, &eax, &ebx, &ecx, &edx) && (ecx & (1u << 22)))
+        leaf = 0x8000001d;
+    if (leaf == 0 || __get_cpuid_max(leaf & 0x80000000u, nullptr) < leaf) return caches;
+
+    for (unsigned sub = 0; sub < 16; ++sub) {
+        __cpuid_count(leaf, sub, eax, ebx, ecx, edx);
+        const unsigned type = eax & 0x1f;
+        if (type == 0) break;
+
+        ReportedCache c;
+        c.level = int((eax >> 5) & 0x7);
+        c.type = type == 1 ? "Data" : type == 2 ? "Instruction" : "Unified";
+        c.line = (ebx & 0xfff) + 1;
+        c.ways = ((ebx >> 22) & 0x3ff) + 1;
+        c.sets = size_t(ecx) + 1;
+        c.bytes = c.ways * (((ebx >> 12) & 0x3ff) + 1) * c.line * c.sets;
+        caches.push_back(std::move(c));
+    }
+#endif
+    return caches;
+}
+
+// sysfs of `cpu` if the kernel exports it, CPUID of the current CPU otherwise; `source` names the one used.
+static std::vector<ReportedCache> reported_caches(int cpu, std::string *source = nullptr) {
+    auto caches = sysfs_caches(cpu);
+    if (source) *source = "sysfs";
+    if (caches.empty()) {
+        caches = cpuid_caches();
+        if (source) *source = caches.empty() ? "" : "cpuid";
+    }
+    return caches;
+}
+
+// *------------------------------------------------------------------------------------*
+// |                                    TIMERS                                          |
+// *------------------------------------------------------------------------------------*
+struct TimerState {
+    TimerBackend backend = TimerBackend::Chrono;
+    double tsc_overhead = 0.0;
+    double tsc_per_ns = 0.0;
+};
+
+static TimerState g_timer;
+
+static const char *timer_unit() {
+    return g_timer.backend == TimerBackend::Chrono ? "ns" : "cycles";
+}
+
+#ifdef HAVE_TSC
+static inline uint64_t tsc_begin() {
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    _mm_lfence();
+    uint64_t t = __rdtsc();
+    _mm_lfence();
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    return t;
+}
+
+static inline uint64_t tsc_end() {
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    unsigned aux;
+    uint64_t t = __rdtscp(&aux);
+    _mm_lfence();
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    return t;
+}
+
+static bool tsc_invariant() {
+    unsigned eax, ebx, ecx, edx;
+    if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx)) return false;
+    return (edx & (1u << 8)) != 0;
+}
+#else
+static inline uint64_t tsc_begin() { return 0; }
+static inline uint64_t tsc_end() { return 0; }
+static bool tsc_invariant() { return false; }
+#endif
+
+static void calibrate_tsc() {
+    double overhead = std::numeric_limits<double>::infinity();
+    for (int i = 0; i < 1000; ++i) {
+        uint64_t t0 = tsc_begin();
+        uint64_t t1 = tsc_end();
+        overhead = std::min(overhead, double(t1 - t0));
+    }
+    g_timer.tsc_overhead = overhead;
+
+    auto c0 = high_resolution_clock::now();
+    uint64_t t0 = tsc_begin();
+    while (high_resolution_clock::now() - c0 < std::chrono::milliseconds(50)) {}
+    uint64_t t1 = tsc_end();
+    auto c1 = high_resolution_clock::now();
+
+    g_timer.tsc_per_ns = double(t1 - t0) / std::chrono::duration<double, std::nano>(c1 - c0).count();
+}
+
+#ifdef HAVE_PERF_EVENTS
+static int open_perf_cycles() {
+    perf_event_attr attr{};
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CPU_CYCLES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+// perf counters are per thread, so every measuring thread opens its own
+static int perf_cycles_fd() {
+    thread_local int fd = open_perf_cycles();
+    if (fd < 0)
+        throw std::runtime_error(std::string("perf_event_open(PERF_COUNT_HW_CPU_CYCLES) недоступен: ") +
+                                 std::strerror(errno));
+    return fd;
+}
+#endif
+
+static void setup_timer(const Options &opts) {
+    g_timer.backend = opts.timer;
+
+    if (opts.timer == TimerBackend::Tsc) {
+#ifdef HAVE_TSC
+        calibrate_tsc();
+        if (opts.verbose) {
+            std::cout << "TSC: " << g_timer.tsc_per_ns << " GHz, overhead " << g_timer.tsc_overhead << " cycles"
+                      << (tsc_invariant() ? "" : " (not invariant!)") << "\n";
+        }
+#else
+        throw std::runtime_error("Таймер tsc не поддерживается на этой архитектуре");
+#endif
+    } else if (opts.timer == TimerBackend::Perf) {
+#ifdef HAVE_PERF_EVENTS
+        perf_cycles_fd();
+#else
+        throw std::runtime_error("Таймер perf не поддерживается на этой платформе");
+#endif
+    }
+}
+
+struct ChronoTimer {
+    using stamp = high_resolution_clock::time_point;
+
+    static stamp start() { return high_resolution_clock::now(); }
+
+    static stamp stop() { return high_resolution_clock::now(); }
+
+    static double elapsed(stamp t0, stamp t1) { return std::chrono::duration<double, std::nano>(t1 - t0).count(); }
+};
+
+struct TscTimer {
+    using stamp = uint64_t;
+
+    static stamp start() { return tsc_begin(); }
+
+    static stamp stop() { return tsc_end(); }
+
+    static double elapsed(stamp t0, stamp t1) { return std::max(0.0, double(t1 - t0) - g_timer.tsc_overhead); }
+};
+
+struct PerfTimer {
+    using stamp = int;
+
+#ifdef HAVE_PERF_EVENTS
+    static stamp start() {
+        const int fd = perf_cycles_fd();
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+        return fd;
+    }
+
+    static stamp stop() {
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+        const int fd = perf_cycles_fd();
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        return fd;
+    }
+
+    static double elapsed(stamp, stamp fd) {
+        uint64_t cycles = 0;
+        if (read(fd, &cycles, sizeof(cycles)) != sizeof(cycles))
+            throw std::runtime_error("Не удалось прочитать счётчик perf");
+        return double(cycles);
+    }
+#else
+    static stamp start() { return -1; }
+
+    static stamp stop() { return -1; }
+
+    static double elapsed(stamp, stamp) { return 0.0; }
+#endif
+};
+
+// A kernel is any type with `auto operator()(size_t count)` that performs `count` accesses and returns a value
+// depending on all of them. Both the timer and the kernel are template parameters, so the timed region holds
+// nothing but the inlined access loop.
+template<class Timer, class Kernel>
+static NOINLINE double measure_with(size_t warm_up, size_t main_loop, Kernel &kernel) {
+    do_not_optimize(kernel(warm_up));
+
+    auto t0 = Timer::start();
+    auto result = kernel(main_loop);
+    do_not_optimize(result);
+    auto t1 = Timer::stop();
+
+    return Timer::elapsed(t0, t1);
+}
+
+template<class Kernel>
+using MeasureFn = double (*)(size_t, size_t, Kernel &);
+
+// indexed by TimerBackend
+template<class Kernel>
+static constexpr MeasureFn<Kernel> measure_table[] = {
+        &measure_with<ChronoTimer, Kernel>,
+        &measure_with<TscTimer, Kernel>,
+        &measure_with<PerfTimer, Kernel>,
+};
+
+template<class Kernel>
+static double measure(size_t warm_up, size_t main_loop, Kernel &kernel) {
+    return measure_table<Kernel>[size_t(g_timer.backend)](warm_up, main_loop, kernel);
+}
+
+// *------------------------------------------------------------------------------------*
+// |                                    KERNELS                                         |
+// *------------------------------------------------------------------------------------*
+struct Node {
+    Node *next;
+};
+
+struct IndexRingKernel {
+    const uint32_t *next;
+
+    uint32_t operator()(size_t count) const {
+        uint32_t cur = 0;
+        for (size_t i = 0; i < count; ++i) cur = next[cur];
+        return cur;
+    }
+};
+
+struct PointerChaseKernel {
+    Node *start;
+
+    Node *operator()(size_t count) {
+        Node *p = start;
+        for (size_t i = 0; i < count; ++i) p = p->next;
+        start = p;
+        return p;
+    }
+};
+
+// N independent rings advanced in lockstep: the loads of one round do not depend on each other.
+template<size_t N>
+struct MultiChaseKernel {
+    Node *heads[N];
+
+    Node *operator()(size_t count) {
+        for (size_t i = 0; i < count; ++i)
+            for (size_t c = 0; c < N; ++c) heads[c] = heads[c]->next;
+
+        Node *acc = heads[0];
+        for (size_t c = 1; c < N; ++c) acc = (Node *) (uintptr_t(acc) ^ uintptr_t(heads[c]));
+        return acc;
+    }
+};
+
+struct EmptyKernel {
+    size_t operator()(size_t count) const { return count; }
+};
+
+// Residual cost of the harness itself (timer reads, call, barriers) per measurement, in ns.
+static double harness_overhead_ns() {
+    EmptyKernel kernel;
+    std::vector<double> results;
+    results.reserve(101);
+    for (int i = 0; i < 101; ++i) results.push_back(measure(0, 0, kernel));
+
+    double overhead = median(results);
+    if (g_timer.backend == TimerBackend::Tsc) overhead /= g_timer.tsc_per_ns;
+    return overhead;
+}
+
+// *------------------------------------------------------------------------------------*
+// |                               VECTOR KERNELS                                       |
+// *------------------------------------------------------------------------------------*
+// Streaming loads/stores at every vector width the build can target. Each ISA gets a set of ops; the generic pass
+// loops are instantiated per ISA inside wrappers compiled for that ISA (target attribute + flatten), so the binary
+// runs on any CPU of the architecture and picks the widths at runtime.
+enum class BandwidthKernel {
+    Read,
+    Write,
+    Copy,
+    NtWrite,
+};
+
+enum class Isa {
+    Scalar,
+    Sse2,
+    Neon,
+    Avx2,
+    Avx512,
+};
+
+#if defined(__GNUC__) || defined(__clang__)
+// the pass loops only ever run inlined into the wrappers below, so the vector-argument ABI does not matter
+#pragma GCC diagnostic ignored "-Wpsabi"
+#define TARGET(ISA) __attribute__((target(ISA)))
+#define FLATTEN __attribute__((flatten))
+#else
+#define TARGET(ISA)
+#define FLATTEN
+#endif
+
+struct ScalarOps {
+    using vec = uint64_t;
+
+    static vec zero() { return 0; }
+
+    static vec set(uint64_t v) { return v; }
+
+    static vec load(const unsigned char *p) { return *(const vec *) p; }
+
+    static void store(unsigned char *p, vec v) { *(vec *) p = v; }
+
+    static void stream(unsigned char *p, vec v) { *(vec *) p = v; }
+
+    static vec mix(vec a, vec b) { return a ^ b; }
+
+    static uint64_t first(vec v) { return v; }
+
+    static void fence() {}
+};
+
+#if defined(__x86_64__) || defined(__i386__)
+struct Sse2Ops {
+    using vec = __m128i;
+
+    static TARGET("sse2") vec zero() { return _mm_setzero_si128(); }
+
+    static TARGET("sse2") vec set(uint64_t v) { return _mm_set1_epi64x((long long) v); }
+
+    static TARGET("sse2") vec load(const unsigned char *p) { return _mm_load_si128((const vec *) p); }
+
+    static TARGET("sse2") void store(unsigned char *p, vec v) { _mm_store_si128((vec *) p, v); }
+
+    static TARGET("sse2") void stream(unsigned char *p, vec v) { _mm_stream_si128((vec *) p, v); }
+
+    static TARGET("sse2") vec mix(vec a, vec b) { return _mm_xor_si128(a, b); }
+
+    // _mm_cvtsi128_si64 exists only on x86-64; a 64-bit store works on i386 too
+    static TARGET("sse2") uint64_t first(vec v) {
+        uint64_t lane;
+        _mm_storel_epi64((vec *) &lane, v);
+        return lane;
+    }
+
+    static TARGET("sse2") void fence() { _mm_sfence(); }
+};
+
+struct Avx2Ops {
+    using vec = __m256i;
+
+    static TARGET("avx2") vec zero() { return _mm256_setzero_si256(); }
+
+    static TARGET("avx2") vec set(uint64_t v) { return _mm256_set1_epi64x((long long) v); }
+
+    static TARGET("avx2") vec load(const unsigned char *p) { return _mm256_load_si256((const vec *) p); }
+
+    static TARGET("avx2") void store(unsigned char *p, vec v) { _mm256_store_si256((vec *) p, v); }
+
+    static TARGET("avx2") void stream(unsigned char *p, vec v) { _mm256_stream_si256((vec *) p, v); }
+
+    static TARGET("avx2") vec mix(vec a, vec b) { return _mm256_xor_si256(a, b); }
+
+    static TARGET("avx2") uint64_t first(vec v) {
+        uint64_t lane;
+        _mm_storel_epi64((__m128i *) &lane, _mm256_castsi256_si128(v));
+        return lane;
+    }
+
+    static TARGET("avx2") void fence() { _mm_sfence(); }
+};
+
+struct Avx512Ops {
+    using vec = __m512i;
+
+    static TARGET("avx512f") vec zero() { return _mm512_setzero_si512(); }
+
+    static TARGET("avx512f") vec set(uint64_t v) { return _mm512_set1_epi64((long long) v); }
+
+    static TARGET("avx512f") vec load(const unsigned char *p) { return _mm512_load_si512((const void *) p); }
+
+    static TARGET("avx512f") void store(unsigned char *p, vec v) { _mm512_store_si512((void *) p, v); }
+
+    static TARGET("avx512f") void stream(unsigned char *p, vec v) { _mm512_stream_si512((vec *) p, v); }
+
+    static TARGET("avx512f") vec mix(vec a, vec b) { return _mm512_xor_si512(a, b); }
+
+    static TARGET("avx512f") uint64_t first(vec v) {
+        alignas(64) uint64_t lanes[8];
+        _mm512_store_si512((void *) lanes, v);
+        return lanes[0];
+    }
+
+    static TARGET("avx512f") void fence() { _mm_sfence(); }
+};
+#endif
+
+#ifdef __aarch64__
+struct NeonOps {
+    using vec = uint8x16_t;
+
+    static vec zero() { return vdupq_n_u8(0); }
+
+    static vec set(uint64_t v) { return vreinterpretq_u8_u64(vdupq_n_u64(v)); }
+
+    static vec load(const unsigned char *p) { return vld1q_u8(p); }
+
+    static void store(unsigned char *p, vec v) { vst1q_u8(p, v); }
+
+    // no non-temporal vector store in NEON intrinsics
+    static void stream(unsigned char *p, vec v) { vst1q_u8(p, v); }
+
+    static vec mix(vec a, vec b) { return veorq_u8(a, b); }
+
+    static uint64_t first(vec v) { return vgetq_lane_u64(vreinterpretq_u64_u8(v), 0); }
+
+    static void fence() {}
+};
+#endif
+
+// `bytes` is a multiple of 4 vectors; every pass touches the whole buffer.
+template<class Ops>
+static inline uint64_t read_passes(unsigned char *, const unsigned char *src, size_t bytes, size_t passes) {
+    constexpr size_t w = sizeof(typename Ops::vec);
+    auto a = Ops::zero(), b = a, c = a, d = a;
+    for (size_t pass = 0; pass < passes; ++pass) {
+        for (size_t off = 0; off < bytes; off += 4 * w) {
+            a = Ops::mix(a, Ops::load(src + off));
+            b = Ops::mix(b, Ops::load(src + off + w));
+            c = Ops::mix(c, Ops::load(src + off + 2 * w));
+            d = Ops::mix(d, Ops::load(src + off + 3 * w));
+        }
+    }
+    return Ops::first(Ops::mix(Ops::mix(a, b), Ops::mix(c, d)));
+}
+
+template<class Ops>
+static inline uint64_t write_passes(unsigned char *dst, const unsigned char *, size_t bytes, size_t passes) {
+    constexpr size_t w = sizeof(typename Ops::vec);
+    for (size_t pass = 0; pass < passes; ++pass) {
+        const auto v = Ops::set(pass);
+        for (size_t off = 0; off < bytes; off += 4 * w) {
+            Ops::store(dst + off, v);
+            Ops::store(dst + off + w, v);
+            Ops::store(dst + off + 2 * w, v);
+            Ops::store(dst + off + 3 * w, v);
+        }
+    }
+    return dst[0];
+}
+
+template<class Ops>
+static inline uint64_t copy_passes(unsigned char *dst, const unsigned char *src, size_t bytes, size_t passes) {
+    constexpr size_t w = sizeof(typename Ops::vec);
+    for (size_t pass = 0; pass < passes; ++pass) {
+        for (size_t off = 0; off < bytes; off += 4 * w) {
+            const auto a = Ops::load(src + off);
+            const auto b = Ops::load(src + off + w);
+            const auto c = Ops::load(src + off + 2 * w);
+            const auto d = Ops::load(src + off + 3 * w);
+            Ops::store(dst + off, a);
+            Ops::store(dst + off + w, b);
+            Ops::store(dst + off + 2 * w, c);
+            Ops::store(dst + off + 3 * w, d);
+        }
+    }
+    return dst[0];
+}
+
+template<class Ops>
+static inline uint64_t nt_write_passes(unsigned char *dst, const unsigned char *, size_t bytes, size_t passes) {
+    constexpr size_t w = sizeof(typename Ops::vec);
+    for (size_t pass = 0; pass < passes; ++pass) {
+        const auto v = Ops::set(pass);
+        for (size_t off = 0; off < bytes; off += 4 * w) {
+            Ops::stream(dst + off, v);
+            Ops::stream(dst + off + w, v);
+            Ops::stream(dst + off + 2 * w, v);
+            Ops::stream(dst + off + 3 * w, v);
+        }
+    }
+    Ops::fence();
+    return dst[0];
+}
+
+using StreamFn = uint64_t (*)(unsigned char *, const unsigned char *, size_t, size_t);
+
+#define STREAM_WRAPPERS(NAME, ATTR, OPS) \
+    static ATTR FLATTEN uint64_t read_##NAME(unsigned char *d, const unsigned char *s, size_t b, size_t n) { \
+        return read_passes<OPS>(d, s, b, n); \
+    } \
+    static ATTR FLATTEN uint64_t write_##NAME(unsigned char *d, const unsigned char *s, size_t b, size_t n) { \
+        return write_passes<OPS>(d, s, b, n); \
+    } \
+    static ATTR FLATTEN uint64_t copy_##NAME(unsigned char *d, const unsigned char *s, size_t b, size_t n) { \
+        return copy_passes<OPS>(d, s, b, n); \
+    } \
+    static ATTR FLATTEN uint64_t nt_write_##NAME(unsigned char *d, const unsigned char *s, size_t b, size_t n) { \
+        return nt_write_passes<OPS>(d, s, b, n); \
+    }
+
+STREAM_WRAPPERS(scalar, , ScalarOps)
+#if defined(__x86_64__) || defined(__i386__)
+STREAM_WRAPPERS(sse2, TARGET("sse2"), Sse2Ops)
+STREAM_WRAPPERS(avx2, TARGET("avx2"), Avx2Ops)
+STREAM_WRAPPERS(avx512, TARGET("avx512f"), Avx512Ops)
+#endif
+#ifdef __aarch64__
+STREAM_WRAPPERS(neon, , NeonOps)
+#endif
+
+struct IsaInfo {
+    Isa isa;
+    const char *name;
+    int bits;
+    StreamFn kernels[4];    // indexed by BandwidthKernel: read, write, copy, nt_write
+};
+
+static const IsaInfo isa_table[] = {
+        {Isa::Scalar, "scalar", 64, {read_scalar, write_scalar, copy_scalar, nt_write_scalar}},
+#if defined(__x86_64__) || defined(__i386__)
+        {Isa::Sse2, "sse2", 128, {read_sse2, write_sse2, copy_sse2, nt_write_sse2}},
+        {Isa::Avx2, "avx2", 256, {read_avx2, write_avx2, copy_avx2, nt_write_avx2}},
+        {Isa::Avx512, "avx512", 512, {read_avx512, write_avx512, copy_avx512, nt_write_avx512}},
+#endif
+#ifdef __aarch64__
+        {Isa::Neon, "neon", 128, {read_neon, write_neon, copy_neon, nt_write_neon}},
+#endif
+};
+
+static bool isa_supported(Isa isa) {
+    switch (isa) {
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+        case Isa::Sse2:
+            return __builtin_cpu_supports("sse2");
+        case Isa::Avx2:
+            return __builtin_cpu_supports("avx2");
+        case Isa::Avx512:
+            return __builtin_cpu_supports("avx512f");
+#endif
+#ifdef __aarch64__
+        case Isa::Neon:
+            return true;
+#endif
+        case Isa::Scalar:
+            return true;
+        default:
+            return false;
+    }
+}
+
+struct StreamKernel {
+    StreamFn fn;
+    unsigned char *dst;
+    const unsigned char *src;
+    size_t bytes;
+
+    uint64_t operator()(size_t count) const { return fn(dst, src, bytes, count); }
+};
+
+// *------------------------------------------------------------------------------------*
+// |                                 L1 SIZE PROBE                                      |
+// *------------------------------------------------------------------------------------*
+// The buffer and ring all points of a size sweep work in: allocated once for the largest point, with the ring
+// resized in place from one point to the next.
+struct RingArena {
+    // the ring touches lines as it grows, so a sweep pays for the memory only up to the size it reaches
+    RingArena(size_t max_bytes, PageBackend pages)
+            : buffer(max_bytes, 64, pages, false), ring(static_cast<uint32_t *>(buffer.data())) {}
+
+    Buffer buffer;
+    RandomRing ring;
+};
+
+static NOINLINE double measure_size_L1(
+        RingArena &arena,
+        size_t lines,
+        uint64_t total_accesses,
+        int trials = 3,
+        std::vector<double> *samples = nullptr
+) {
+    if (arena.buffer.data() == nullptr) return 0.0;
+    check_cancelled();
+    arena.ring.resize(lines);
+    // the kernel starts at line 0 on every call: fewer accesses than lines would leave the tail of the ring
+    // untouched and the footprint smaller than the size, so a budgeted run (few accesses) covers the ring once
+    if (g_budget.active) total_accesses = std::max<uint64_t>(total_accesses, lines);
+
+    std::vector<double> results;
+    results.reserve(trials);
+
+    for (int t = 0; more_trials(results, trials); ++t) {
+
+        IndexRingKernel kernel{arena.ring.data()};
+        double ns = measure(std::min<std::uint64_t>(200000, total_accesses), total_accesses, kernel);
+
+        results.push_back(ns / double(total_accesses));
+    }
+    if (samples) *samples = results;
+    return median(results);
+}
+
+static SizePoint measure_ring_point(size_t bytes, const Options &opts, RingArena &arena) {
+    const size_t lines = std::max<size_t>(bytes, 4096) / 64;
+    std::vector<double> samples;
+    const PageBackend obtained = arena.buffer.backend();
+    double ns = measure_size_L1(arena, lines, opts.total_accesses, opts.trials, &samples);
+
+    if (opts.verbose) {
+        std::cout << std::to_string(bytes / 1024) << "\t\t" << ns << "\t" << page_backend_name(obtained) << "\n";
+    }
+    return {bytes, ns, std::move(samples), obtained};
+}
+
+// Coarse logarithmic pass (2 points per octave), segmentation, then bisection of every detected step until the
+// boundary is known within opts.tolerance. A size belongs to the lower level while it has gone less than a tenth of
+// the way to the next plateau (and stays within the noise of its own); the final bracket is the level's interval.
+static std::vector<CacheLevel> sweep_ring_sizes(
+        size_t min_bytes,
+        size_t max_bytes,
+        const Options &opts,
+        std::vector<SizePoint> &pts,
+        const std::vector<size_t> &expected,
+        std::string *reason = nullptr,
+        Segmentation *seg = nullptr
+) {
+    const auto grid = budgeted(make_log_sizes_grid(min_bytes, max_bytes, 2), expected);
+    RingArena arena(grid.empty() ? 0 : std::max<size_t>(max_bytes, 4096), opts.pages_size);
+
+    // Under a budget a point is skipped unless it fits in what is left of the phase: its cost is its ring setup
+    // plus one trial over the whole ring, at the worst wall-clock time per line seen so far. A line of a ring
+    // larger than any measured yet may miss every cache that has not been reached, so it counts as a DRAM miss.
+    const double dram_ns_per_line = 100.0;
+    size_t largest = 0;
+    double ns_per_line = 0.0;
+    auto work = [&](size_t bytes) {
+        const size_t lines = std::max<size_t>(bytes, 4096) / 64;
+        return double(lines) + double(std::max<uint64_t>(opts.total_accesses, lines));
+    };
+    auto affordable = [&](size_t bytes) {
+        if (!g_budget.active) return true;
+        const double per_line = bytes > largest ? std::max(ns_per_line, dram_ns_per_line) : ns_per_line;
+        const auto cost = std::chrono::nanoseconds(long(per_line * work(bytes)));
+        return std::chrono::steady_clock::now() + cost < g_budget.phase_end;
+    };
+    auto measure_point = [&](size_t bytes) {
+        const auto start = std::chrono::steady_clock::now();
+        SizePoint p = measure_ring_point(bytes, opts, arena);
+        const std::chrono::duration<double, std::nano> took = std::chrono::steady_clock::now() - start;
+        const double trials = double(std::max<size_t>(p.samples.size(), 1));
+        largest = std::max(largest, bytes);
+        ns_per_line = std::max(ns_per_line, took.count() / (work(bytes) * trials));
+        return p;
+    };
+
+    for (size_t bytes: grid) {
+        if (!affordable(bytes)) {
+            ++g_budget.skipped;
+            continue;
+        }
+        pts.push_back(measure_point(bytes));
+    }
+    std::sort(pts.begin(), pts.end(), [](const SizePoint &a, const SizePoint &b) { return a.bytes < b.bytes; });
+
+    Segmentation local;
+    if (seg == nullptr) seg = &local;
+    auto levels = detect_levels(pts, 1.3, reason, seg);
+    const double seg_noise = seg->noise;
+
+    for (size_t l = 0; l + 1 < levels.size(); ++l) {
+        size_t lo = levels[l].bytes;
+        auto above = std::upper_bound(pts.begin(), pts.end(), lo, [](size_t b, const SizePoint &p) {
+            return b < p.bytes;
+        });
+        if (above == pts.end()) continue;
+        size_t hi = above->bytes;
+
+        const double threshold = std::max(levels[l].per_access * std::exp(3.0 * seg_noise),
+                                          levels[l].per_access + 0.1 * (levels[l + 1].per_access - levels[l].per_access));
+        while (double(hi - lo) > std::max(opts.tolerance * double(lo), 1024.0)) {
+            check_cancelled();
+            const size_t mid = align_up(size_t(std::sqrt(double(lo) * double(hi))), 1024);
+            if (mid <= lo || mid >= hi) break;
+            if (!affordable(mid)) {
+                ++g_budget.skipped;
+                break;
+            }
+
+            SizePoint p = measure_point(mid);
+            if (p.per_access >= threshold) hi = mid;
+            else lo = mid;
+
+            auto at = std::lower_bound(pts.begin(), pts.end(), mid, [](const SizePoint &q, size_t b) {
+                return q.bytes < b;
+            });
+            pts.insert(at, std::move(p));
+        }
+        levels[l].bytes = levels[l].bytes_lo = lo;
+        levels[l].bytes_hi = hi;
+    }
+
+    return levels;
+}
+
+static size_t detect_size_L1(const Options &opts, Report *report = nullptr) {
+    std::vector<SizePoint> pts;
+
+    if (opts.verbose) {
+        std::cout << "\nL1 size probe:\n";
+        std::cout << "Size(KB)\t" << timer_unit() << "/access\tpages\n";
+    }
+
+    std::string reason;
+    Segmentation seg;
+    const auto hints = os_cache_sizes();
+    auto levels = sweep_ring_sizes(2 * 1024, 1024 * 1024, opts, pts,
+                                   std::vector<size_t>(hints.begin(), hints.begin() + std::min<size_t>(hints.size(), 1)),
+                                   &reason, &seg);
+
+    if (report) {
+        report->curves.push_back({"l1_size", "bytes", pts, {
+                {"min_step_ratio", 1.3}, {"noise", seg.noise}, {"penalty", seg.penalty},
+                {"tolerance", opts.tolerance}}, opts.pages_size});
+        if (levels.size() > 1) {
+            report->estimates.emplace_back("l1_bytes_lo", double(levels.front().bytes_lo));
+            report->estimates.emplace_back("l1_bytes_hi", double(levels.front().bytes_hi));
+        } else {
+            report->notes.emplace_back("l1_bytes", reason);
+        }
+    }
+
+    return levels.size() > 1 ? levels.front().bytes : 0;
+}
+
+// *------------------------------------------------------------------------------------*
+// |                              CACHE HIERARCHY PROBE                                 |
+// *------------------------------------------------------------------------------------*
+static size_t llc_size_hint() {
+#ifdef _SC_LEVEL3_CACHE_SIZE
+    long l3 = sysconf(_SC_LEVEL3_CACHE_SIZE);
+    if (l3 > 0) return size_t(l3);
+    long l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    if (l2 > 0) return size_t(l2);
+#endif
+    return 0;
+}
+
+static size_t hierarchy_max_bytes(const Options &opts) {
+    if (opts.max_bytes != 0) return opts.max_bytes;
+
+    const size_t llc = llc_size_hint();
+    if (llc == 0) return 256ULL * 1024 * 1024;
+    return std::clamp<size_t>(4 * llc, 16ULL * 1024 * 1024, 1024ULL * 1024 * 1024);
+}
+
+static std::vector<CacheLevel> detect_hierarchy(const Options &opts, Report *report = nullptr) {
+    std::vector<SizePoint> pts;
+
+    if (opts.verbose) {
+        std::cout << "\nCache hierarchy probe:\n";
+        std::cout << "Size(KB)\t" << timer_unit() << "/access\tpages\n";
+    }
+
+    std::string reason;
+    Segmentation seg;
+    auto levels = sweep_ring_sizes(2 * 1024, hierarchy_max_bytes(opts), opts, pts, os_cache_sizes(), &reason, &seg);
+
+    if (report) {
+        report->curves.push_back({"hierarchy", "bytes", pts, {
+                {"min_step_ratio", 1.3}, {"noise", seg.noise}, {"penalty", seg.penalty},
+                {"tolerance", opts.tolerance}}, opts.pages_size});
+        if (levels.size() <= 1) report->notes.emplace_back("hierarchy", reason);
+    }
+
+    return levels;
+}
+
+// *------------------------------------------------------------------------------------*
+// |                          L1 ASSOCIATIVITY (WAYS) PROBE                             |
+// *------------------------------------------------------------------------------------*
+// Chase over the lines at `offsets` into `buffer`, in a fresh random order every trial.
+static NOINLINE double measure_chase(
+        const Buffer &buffer,
+        const std::vector<size_t> &offsets,
+        uint64_t total_accesses,
+        int trials = 3,
+        std::vector<double> *samples = nullptr
+) {
+    void *raw = buffer.data();
+    if (raw == nullptr || offsets.empty()) return 0.0;
+
+
+    std::vector<double> results;
+    results.reserve(trials);
+
+    for (int t = 0; more_trials(results, trials); ++t) {
+        std::vector<Node *> nodes;
+        nodes.reserve(offsets.size());
+
+        for (size_t offset: offsets) {
+            auto p = (Node *) ((unsigned char *) raw + offset);
+            nodes.push_back(p);
+        }
+
+        std::mt19937 rng(1000 + t);
+        std::shuffle(nodes.begin(), nodes.end(), rng);
+
+        for (size_t i = 0; i + 1 < nodes.size(); ++i)
+            nodes[i]->next = nodes[i + 1];
+        nodes.back()->next = nodes.front();
+
+        PointerChaseKernel kernel{nodes.front()};
+        double ns = measure(std::min<std::uint64_t>(200000, total_accesses), total_accesses, kernel);
+
+        results.push_back(ns / (double) total_accesses);
+    }
+
+    if (samples) *samples = results;
+    return median(results);
+}
+
+// Chase over k lines `stride` apart (a page for the classic probe: the same L1 set); `buffer` holds at least
+// k_lines strides and is allocated once by the caller for its largest k.
+static double measure_associativity(
+        const Buffer &buffer,
+        size_t k_lines,
+        size_t stride,
+        uint64_t total_accesses,
+        int trials = 3,
+        std::vector<double> *samples = nullptr
+) {
+    std::vector<size_t> offsets(k_lines);
+    for (size_t i = 0; i < k_lines; ++i) offsets[i] = i * stride;
+    return measure_chase(buffer, offsets, total_accesses, trials, samples);
+}
+
+static size_t detect_associativity_L1(size_t page_size, const Options &opts, Report *report = nullptr) {
+    const size_t k_min = 2;
+    const size_t k_max = 32;
+
+
+    std::vector<SizePoint> pts;
+    pts.reserve(k_max - k_min + 1);
+
+    if (opts.verbose) {
+        std::cout << "\nAssociativity probe (same-set via page stride):\n";
+        std::cout << "k_lines\t " << timer_unit() << "/access\tpages\n";
+    }
+
+    std::vector<size_t> ks;
+    for (size_t k = k_min; k <= k_max; k += 2) ks.push_back(k);
+
+    ks = budgeted(ks, {os_l1_ways()});
+    const Buffer buffer(ks.empty() ? 0 : k_max * page_size + page_size, page_size, opts.pages_assoc);
+    const PageBackend obtained = buffer.backend();
+
+    for (size_t k: ks) {
+        if (budget_expired()) {
+            ++g_budget.skipped;
+            continue;
+        }
+        std::vector<double> samples;
+        double ns = measure_associativity(buffer, k, page_size, opts.total_accesses, opts.trials, &samples);
+        pts.push_back({k, ns, std::move(samples), obtained});
+
+        if (opts.verbose) {
+            std::cout << k << "\t " << ns << "\t" << page_backend_name(obtained) << "\n";
+        }
+    }
+    std::sort(pts.begin(), pts.end(), [](const SizePoint &a, const SizePoint &b) { return a.bytes < b.bytes; });
+
+    const Segmentation seg = segment_curve(pts, 1.2);
+    const size_t i = first_step_up(seg);
+
+    if (report) {
+        report->curves.push_back({"associativity", "k_lines", pts, {
+                {"min_step_ratio", 1.2}, {"noise", seg.noise}, {"penalty", seg.penalty}}, opts.pages_assoc});
+        if (i == 0) {
+            report->notes.emplace_back("l1_ways", seg.reason.empty() ? "no upward step" : seg.reason);
+        } else {
+            size_t k = 0;
+            while (seg.segments[k + 1].from != i) ++k;
+            const auto ci = change_point_interval(pts, seg, k);
+            report->estimates.emplace_back("l1_ways_lo", double(pts[ci.first].bytes));
+            report->estimates.emplace_back("l1_ways_hi", double(pts[ci.second].bytes));
+        }
+    }
+
+    return i == 0 ? 0 : pts[i - 1].bytes;
+}
+
+// *------------------------------------------------------------------------------------*
+// |                                 L1 STRIDE PROBE                                    |
+// *------------------------------------------------------------------------------------*
+static std::size_t stride_buffer_bytes(std::size_t page_size) {
+    return align_up(10 * 1024ull * 1024ull, page_size);
+}
+
+// `buffer` holds stride_buffer_bytes(); the probe allocates it once for all strides.
+static NOINLINE double measure_stride(
+        const Buffer &buffer,
+        std::size_t page_size,
+        std::size_t stride,
+        std::uint64_t total_accesses,
+        int trials = 3,
+        std::vector<double> *samples = nullptr
+) {
+    const std::size_t bytes = stride_buffer_bytes(page_size);
+    void *mem = buffer.data();
+    if (mem == nullptr) return 0.0;
+
+    auto *base = reinterpret_cast<std::uint8_t *>(mem);
+
+    const std::size_t ptrAlign = alignof(Node);
+    stride = std::max(stride, sizeof(Node));
+    stride = align_up(stride, ptrAlign);
+
+    std::size_t count = bytes / stride;
+    if (count < 2) return std::numeric_limits<double>::infinity();
+
+    std::vector<double> results;
+    results.reserve(trials);
+
+    std::vector<std::size_t> idx(count);
+    for (int t = 0; more_trials(results, trials); ++t) {
+
+        random_permutation(idx.data(), count, 1212ULL * t);
+        // a budgeted run links only the lines it visits: a random subset still spans the whole buffer
+        std::size_t ring = count;
+        if (g_budget.active && total_accesses < count) ring = std::max<std::size_t>(total_accesses, 2);
+
+        link_cycle(ring, [&](std::size_t i, std::size_t j) {
+            reinterpret_cast<Node *>(base + idx[i] * stride)->next = reinterpret_cast<Node *>(base + idx[j] * stride);
+        });
+
+        Node *start = reinterpret_cast<Node *>(base + idx[0] * stride);
+
+
+        // every line at least 16 times; a budgeted run takes what total_accesses gives
+        std::uint64_t steps = total_accesses;
+        if (steps < count * 16 && !g_budget.active) steps = static_cast<std::uint64_t>(count) * 16;
+
+        PointerChaseKernel kernel{start};
+        double ns = measure(std::min<std::uint64_t>(200000, steps), steps, kernel);
+
+        results.push_back(ns / static_cast<double>(steps));
+    }
+
+    if (samples) *samples = results;
+    return median(results);
+}
+
+
+static size_t detect_stride_size_L1(size_t page_size, const Options &opts, Report *report = nullptr) {
+    std::size_t max_stride = 1024;
+
+    if (opts.verbose) {
+        std::cout << "\n\nStride bytes\t" << timer_unit() << "/access\tpages\n\n";
+    }
+
+    std::vector<SizePoint> pts;
+
+    std::vector<size_t> strides;
+    for (std::size_t stride = 8; stride <= max_stride; stride *= 2) strides.push_back(stride);
+
+    strides = budgeted(strides, {os_l1_line()});
+    const Buffer buffer(strides.empty() ? 0 : stride_buffer_bytes(page_size), page_size, opts.pages_stride);
+    const PageBackend obtained = buffer.backend();
+
+    for (std::size_t stride: strides) {
+        if (budget_expired()) {
+            ++g_budget.skipped;
+            continue;
+        }
+        std::vector<double> samples;
+        double ns = measure_stride(buffer, page_size, stride, opts.total_accesses, opts.trials, &samples);
+        pts.push_back({stride, ns, std::move(samples), obtained});
+        if (opts.verbose) {
+            std::cout << (stride) << "\t\t" << ns << "\t" << page_backend_name(obtained) << "\n";
+        }
+    }
+    std::sort(pts.begin(), pts.end(), [](const SizePoint &a, const SizePoint &b) { return a.bytes < b.bytes; });
+
+    // one point per octave: a single point above the step is already a segment
+    const Segmentation seg = segment_curve(pts, 1.3, 1);
+    const size_t i = first_step_up(seg);
+
+    if (report) {
+        report->curves.push_back({"stride", "stride_bytes", pts, {
+                {"min_step_ratio", 1.3}, {"noise", seg.noise}, {"penalty", seg.penalty}}, opts.pages_stride});
+        if (i == 0) report->notes.emplace_back("l1_line_bytes", seg.reason.empty() ? "no upward step" : seg.reason);
+    }
+
+    return i == 0 ? 0 : pts[i].bytes;
+}
+
+
+// *------------------------------------------------------------------------------------*
+// |                                 CACHE SET PROBE                                    |
+// *------------------------------------------------------------------------------------*
+// k lines `stride` apart fall into max(1, way_bytes / stride) sets of a linearly indexed cache, so the smallest k
+// that misses halves with every doubling of the stride until the stride reaches the way size (sets x line) and
+// stays at ways + 1 from there on. Huge pages keep virtual and physical addresses equal up to 2 MB, so
+// index bits above the 4 KB page offset show up as well.
+static constexpr size_t sets_max_stride = 64 * 1024;
+static constexpr size_t sets_buffer_bytes = 16 * 1024 * 1024;
+
+// Smallest k in 2..k_max whose chase is slower than `threshold` (bisection, the chase slows down monotonically
+// with k); 0 if even k_max is fast.
+static size_t first_missing_k(const Buffer &buffer, size_t stride, size_t k_max, double threshold,
+                              const Options &opts) {
+    auto slow = [&](size_t k) {
+        return measure_associativity(buffer, k, stride, opts.total_accesses, opts.trials) > threshold;
+    };
+    if (!slow(k_max)) return 0;
+
+    size_t fast = 1, missing = k_max;
+    while (missing - fast > 1) {
+        const size_t mid = fast + (missing - fast) / 2;
+        if (slow(mid)) missing = mid;
+        else fast = mid;
+    }
+    return missing;
+}
+
+static void detect_sets_l1(size_t page_size, const Options &opts, Report &report) {
+    // the reported line size wins: the measured one is unreliable on VMs and would shift every index bit
+    const auto measured_line = size_t(estimate(report, "l1_line_bytes"));
+    const size_t line = os_l1_line() != 0 ? os_l1_line() : measured_line != 0 ? measured_line : 64;
+    report.estimates.emplace_back("sets_l1_line_bytes", double(line));
+    if (measured_line != 0 && measured_line != line) {
+        report.notes.emplace_back("sets_l1_line", "measured line " + std::to_string(measured_line) +
+                                                  " B differs from the reported " + std::to_string(line) + " B");
+    }
+    const Buffer buffer(sets_buffer_bytes, page_size, opts.pages_sets);
+    if (buffer.data() == nullptr) {
+        report.notes.emplace_back("sets_l1", "no memory for the buffer");
+        return;
+    }
+
+    // one line is an L1 hit; a chase 1.5x slower has started to miss
+    const double hit = measure_associativity(buffer, 1, line, opts.total_accesses, opts.trials);
+    const double threshold = 1.5 * hit;
+
+    if (opts.verbose) {
+        std::cout << "\nCache set probe (L1, " << page_backend_name(buffer.backend()) << " pages, hit " << hit << " "
+                  << timer_unit() << "/access):\nstride\tfirst missing k\n";
+    }
+
+    std::vector<std::pair<size_t, size_t>> first_missing;
+    for (size_t stride = 2 * line; stride <= sets_max_stride; stride *= 2) {
+        const size_t k = first_missing_k(buffer, stride, std::min<size_t>(1024, sets_buffer_bytes / stride),
+                                         threshold, opts);
+        first_missing.emplace_back(stride, k);
+        report.estimates.emplace_back("sets_l1_k_" + std::to_string(stride), double(k));
+        if (opts.verbose) std::cout << stride << "\t" << k << "\n";
+    }
+
+    // k lines of one set miss once k exceeds the ways, so the largest strides level off at ways + 1; the way size
+    // is the first stride already within 1.5x of that
+    const size_t ways = first_missing.back().second - (first_missing.back().second > 0);
+    if (ways <= 1) {
+        report.notes.emplace_back("sets_l1", "no conflict misses up to " + std::to_string(sets_buffer_bytes /
+                                                                                            sets_max_stride) + " lines");
+        return;
+    }
+    size_t way_bytes = 0;
+    for (const auto &[stride, k]: first_missing) {
+        if (k != 0 && double(k) < 1.5 * double(ways + 1)) {
+            way_bytes = stride;
+            break;
+        }
+    }
+    if (way_bytes == 0) {
+        report.notes.emplace_back("sets_l1", "no stride where the first missing k levels off at ways + 1");
+        return;
+    }
+
+    size_t index_lo = 0, index_hi = 0;
+    while ((size_t(1) << index_lo) < line) ++index_lo;
+    while ((size_t(2) << index_hi) < way_bytes) ++index_hi;
+
+    report.estimates.emplace_back("sets_l1_ways", double(ways));
+    report.estimates.emplace_back("sets_l1_way_bytes", double(way_bytes));
+    report.estimates.emplace_back("sets_l1_sets", double(way_bytes / line));
+    report.estimates.emplace_back("sets_l1_index_lo", double(index_lo));
+    report.estimates.emplace_back("sets_l1_index_hi", double(index_hi));
+    report.estimates.emplace_back("sets_l1_vipt", way_bytes <= page_size ? 1.0 : 0.0);
+}
+
+static size_t power_of_two_above(size_t x) {
+    size_t p = 1;
+    while (p < x) p *= 2;
+    return p;
+}
+
+// Latency of random rings of half and twice `bytes`: a hit in the cache of that size and a miss to the next level.
+static std::pair<double, double> level_references(size_t bytes, PageBackend pages, const Options &opts) {
+    RingArena arena(2 * bytes, pages);
+    const double hit = measure_size_L1(arena, bytes / 2 / 64, opts.total_accesses, opts.trials);
+    const double next = measure_size_L1(arena, 2 * bytes / 64, opts.total_accesses, opts.trials);
+    return {hit, next};
+}
+
+// Outer levels, starting from the reported geometry: 2 x ways lines one way size apart (at most 2 MB, so they
+// share the bits below a huge page) all fall into one set of a linearly indexed cache and miss it; a hashed
+// index (LLC slices, XOR-folded set bits) scatters them and they still hit. Hit and miss references are random
+// rings of half and twice the cache size. This is a conflict-latency heuristic, not a recovery of the index
+// function: one comparison, which page placement or a non-LRU policy can sway; --evict builds actual eviction sets.
+static void detect_sets_outer(const ReportedCache &cache, const Options &opts, Report &report) {
+    const std::string name = "sets_l" + std::to_string(cache.level);
+    const size_t huge_page = 2ULL << 20;
+    const size_t stride = std::min(power_of_two_above(cache.bytes / std::max<size_t>(cache.ways, 1)), huge_page);
+    const size_t k = 2 * std::max<size_t>(cache.ways, 1);
+
+    const Buffer buffer(k * stride, huge_page, opts.pages_sets);
+    if (buffer.data() == nullptr) {
+        report.notes.emplace_back(name, "no memory for the buffer");
+        return;
+    }
+    if (buffer.backend() == PageBackend::Default && stride > size_t(sysconf(_SC_PAGESIZE))) {
+        report.notes.emplace_back(name, "needs huge pages (--pages sets=thp|2m)");
+        return;
+    }
+
+    const auto [hit, next] = level_references(cache.bytes, opts.pages_sets, opts);
+    const double conflict = measure_associativity(buffer, k, stride, opts.total_accesses, opts.trials);
+
+    if (opts.verbose) {
+        std::cout << "\nCache set probe (L" << cache.level << ", " << k << " lines " << stride << " B apart):\n"
+                  << "hit " << hit << ", next level " << next << ", conflict " << conflict << " " << timer_unit()
+                  << "/access\n";
+    }
+
+    report.estimates.emplace_back(name + "_stride", double(stride));
+    report.estimates.emplace_back(name + "_lines", double(k));
+    report.estimates.emplace_back(name + "_hit", hit);
+    report.estimates.emplace_back(name + "_next", next);
+    report.estimates.emplace_back(name + "_conflict", conflict);
+    if (next < 1.3 * hit) {
+        report.notes.emplace_back(name, "no latency step between half and twice the reported size");
+        return;
+    }
+    report.estimates.emplace_back(name + "_hashed", conflict < std::sqrt(hit * next) ? 1.0 : 0.0);
+    report.estimates.emplace_back(name + "_sets_pow2", (cache.sets & (cache.sets - 1)) == 0 ? 1.0 : 0.0);
+}
+
+static void detect_sets(size_t page_size, const Options &opts, Report &report) {
+    detect_sets_l1(page_size, opts, report);
+
+    std::string source;
+    for (const auto &cache: reported_caches(current_cpu(), &source))
+        if (cache.level >= 2 && cache.type != "Instruction" && cache.bytes > 0) detect_sets_outer(cache, opts, report);
+    if (source.empty()) report.notes.emplace_back("sets_outer", "no reported L2/L3 geometry to start from");
+}
+
+// *------------------------------------------------------------------------------------*
+// |                                  EVICTION SETS                                     |
+// *------------------------------------------------------------------------------------*
+// A minimal eviction set of a target line: the fewest lines whose traversal pushes the target out of the cache.
+// Candidates are lines a page apart from the target (same page offset, so the same L1 set and the low index bits
+// of L2/L3); a pool of twice the cache size evicts by capacity alone. Group-testing reduction (split into
+// ways + 1 groups, drop a group whose removal still evicts) shrinks it to a few sets' worth in O(ways^2 x pool)
+// accesses, then single lines are dropped while the rest still evicts. The minimal set's size is the effective
+// associativity of the target's set: ways of the LLC slice the target maps to, fewer if CAT limits the ways this
+// CPU may fill, more for a non-inclusive LLC that is filled from L2 evictions.
+//
+// Only the target's own latency tells whether it was evicted: a chase average over the whole set would drop below
+// any threshold as soon as the other sets stop thrashing, long before the target's set fits. Non-LRU policies
+// evict the target from a set one line short only now and then, so a set counts as evicting when it does so in
+// 3 rounds out of 4.
+static constexpr int evict_targets = 4;
+static constexpr int evict_rounds = 12;
+
+// One timed access to `target` after touching it and chasing twice through `lines` (in random order), for each
+// of evict_rounds rounds. Just before the timed access another line of the target's page (half a page away, so in
+// other sets) is touched: with hundreds of pages in the chase a TLB miss would pass for an eviction otherwise.
+static std::vector<double> target_latencies(const Buffer &buffer, size_t target, const std::vector<size_t> &lines) {
+    auto raw = (unsigned char *) buffer.data();
+    auto x = (Node *) (raw + target);
+    x->next = x;
+    auto neighbour = (Node *) (raw + (target ^ 2048));
+    neighbour->next = neighbour;
+
+    std::vector<Node *> nodes;
+    nodes.reserve(lines.size());
+    for (size_t offset: lines) nodes.push_back((Node *) (raw + offset));
+    std::mt19937 rng(1000);
+    std::shuffle(nodes.begin(), nodes.end(), rng);
+    for (size_t i = 0; i + 1 < nodes.size(); ++i)
+        nodes[i]->next = nodes[i + 1];
+    if (!nodes.empty()) nodes.back()->next = nodes.front();
+
+    std::vector<double> times;
+    times.reserve(evict_rounds);
+    for (int r = 0; r < evict_rounds; ++r) {
+        PointerChaseKernel touch{x};
+        do_not_optimize(touch(1));
+        if (!nodes.empty()) {
+            PointerChaseKernel walk{nodes.front()};
+            do_not_optimize(walk(2 * nodes.size()));
+        }
+        PointerChaseKernel page{neighbour};
+        do_not_optimize(page(1));
+        PointerChaseKernel probe{x};
+        times.push_back(measure(0, 1, probe));
+    }
+    return times;
+}
+
+static bool evicts(const Buffer &buffer, size_t target, const std::vector<size_t> &lines, double threshold) {
+    const auto times = target_latencies(buffer, target, lines);
+    return 4 * std::count_if(times.begin(), times.end(), [&](double t) { return t > threshold; }) >= 3 * evict_rounds;
+}
+
+// Reduces `lines` to a minimal eviction set of `target`; false if the pool or the result does not evict it in 3
+// rounds out of 4. When no group can be dropped, the last drop was likely a lucky round that took a needed line
+// with it: that group goes back and the lines are regrouped in a new order, at most evict_backtracks times.
+static constexpr int evict_backtracks = 16;
+
+static bool reduce_eviction_set(const Buffer &buffer, size_t target, std::vector<size_t> &lines, size_t ways,
+                                double threshold) {
+    if (!evicts(buffer, target, lines, threshold)) return false;
+
+    const size_t groups = ways + 1;
+    std::vector<std::vector<size_t>> dropped;
+    std::mt19937 rng(target);
+    for (int backtracks = 0; lines.size() > groups;) {
+        bool reduced = false;
+        for (size_t g = 0; g < groups && !reduced; ++g) {
+            std::vector<size_t> rest, group;
+            rest.reserve(lines.size());
+            for (size_t i = 0; i < lines.size(); ++i)
+                (i % groups != g ? rest : group).push_back(lines[i]);
+            if (evicts(buffer, target, rest, threshold)) {
+                lines = std::move(rest);
+                dropped.push_back(std::move(group));
+                reduced = true;
+            }
+        }
+        if (reduced) continue;
+        if (++backtracks > evict_backtracks) break;
+        if (!dropped.empty()) {
+            lines.insert(lines.end(), dropped.back().begin(), dropped.back().end());
+            dropped.pop_back();
+        }
+        std::shuffle(lines.begin(), lines.end(), rng);
+    }
+    // a stalled reduction is left for the caller to reject: pruning it line by line would not reach the set either
+    if (lines.size() > 2 * groups) return true;
+
+    for (size_t i = lines.size(); i-- > 0;) {
+        std::vector<size_t> rest(lines);
+        rest.erase(rest.begin() + long(i));
+        if (evicts(buffer, target, rest, threshold)) lines = std::move(rest);
+    }
+    // a set that evicted only by luck of the chase order fails here
+    return evicts(buffer, target, lines, threshold);
+}
+
+// Hex CAT mask of the default resctrl group for the cache `level` with sysfs id `cache_id`; empty without resctrl.
+static std::string resctrl_mask(int level, const std::string &cache_id) {
+    std::ifstream in("/sys/fs/resctrl/schemata");
+    const std::string prefix = "L" + std::to_string(level) + ":";
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.rfind(prefix, 0) != 0) continue;
+        std::stringstream domains(line.substr(prefix.size()));
+        std::string domain;
+        while (std::getline(domains, domain, ';')) {
+            const auto eq = domain.find('=');
+            if (eq != std::string::npos && std::stoi(domain.substr(0, eq)) == std::stoi(cache_id))
+                return domain.substr(eq + 1);
+        }
+    }
+    return {};
+}
+
+static void detect_eviction_sets(const ReportedCache &cache, size_t page_size, const Options &opts,
+                                 Report &report) {
+    const std::string name = "evict_l" + std::to_string(cache.level);
+    const size_t pool = 2 * cache.bytes / page_size;
+    const Buffer buffer((pool + 1) * page_size, page_size, opts.pages_evict);
+    if (buffer.data() == nullptr) {
+        report.notes.emplace_back(name, "no memory for the pool");
+        return;
+    }
+
+    if (opts.verbose) {
+        std::cout << "\nEviction sets (L" << cache.level << ", pool of " << pool << " lines " << page_size
+                  << " B apart, " << timer_unit() << " per timed access):\ntarget\tkept\tevicted\tlines\n";
+    }
+
+    // targets on different page offsets fall into different sets and, with a hashed LLC, likely different slices
+    std::vector<double> sizes;
+    std::string failure;
+    for (int t = 0; t < evict_targets; ++t) {
+        const size_t target = size_t(t) * 64 * 17 % page_size;
+        std::vector<size_t> lines(pool);
+        for (size_t i = 0; i < pool; ++i) lines[i] = target + (i + 1) * page_size;
+
+        // timed single accesses carry the timer overhead, so the threshold comes from the target itself: right
+        // after touching it and after the whole pool, which evicts by capacity
+        auto kept_times = target_latencies(buffer, target, {});
+        auto evicted_times = target_latencies(buffer, target, lines);
+        const double kept = median(kept_times), evicted = median(evicted_times);
+        if (opts.verbose) std::cout << target << "\t" << kept << "\t" << evicted << "\t" << std::flush;
+        if (evicted < 1.3 * kept) {
+            if (opts.verbose) std::cout << "-\n";
+            failure = "the pool does not slow the target down";
+            continue;
+        }
+
+        if (!reduce_eviction_set(buffer, target, lines, std::max<size_t>(cache.ways, 1), (kept + evicted) / 2)) {
+            if (opts.verbose) std::cout << "-\n";
+            failure = "no stable eviction set (replacement policy, or pages not contiguous on the host)";
+            continue;
+        }
+        if (opts.verbose) std::cout << lines.size() << "\n";
+        // far more lines than ways: the reduction stalled, the size says nothing about the associativity
+        if (lines.size() > 2 * std::max<size_t>(cache.ways, 1)) {
+            failure = "reduction stalled at " + std::to_string(lines.size()) + " lines";
+            continue;
+        }
+        report.estimates.emplace_back(name + "_ways_" + std::to_string(t), double(lines.size()));
+        sizes.push_back(double(lines.size()));
+    }
+    if (sizes.empty()) {
+        report.notes.emplace_back(name, failure);
+        return;
+    }
+    report.estimates.emplace_back(name + "_ways", median(sizes));
+    report.estimates.emplace_back(name + "_reported_ways", double(cache.ways));
+
+    const std::string mask = cache.id.empty() ? "" : resctrl_mask(cache.level, cache.id);
+    if (!mask.empty()) {
+        size_t ways = 0;
+        for (auto bits = std::stoull(mask, nullptr, 16); bits != 0; bits &= bits - 1) ++ways;
+        report.estimates.emplace_back(name + "_cat_ways", double(ways));
+        report.notes.emplace_back(name + "_cat", "resctrl mask " + mask);
+    }
+}
+
+static void detect_eviction(size_t page_size, const Options &opts, Report &report) {
+    bool any = false;
+    for (const auto &cache: reported_caches(current_cpu(), nullptr)) {
+        if (cache.level >= 2 && cache.type != "Instruction" && cache.bytes > 0) {
+            detect_eviction_sets(cache, page_size, opts, report);
+            any = true;
+        }
+    }
+    if (!any) report.notes.emplace_back("evict_l2", "no reported L2/L3 geometry to start from");
+}
+
+// *------------------------------------------------------------------------------------*
+// |                               REPLACEMENT POLICY                                   |
+// *------------------------------------------------------------------------------------*
+// Lines of one set (a page apart for L1, one way size apart for L2/L3, as in the associativity and set probes) are
+// chased in fixed canonical orders, and the same orders are run through software models of the candidate policies.
+// Latencies become miss ratios between a loop over `ways` lines (hits under every model) and one over 2 x ways
+// lines; each model's steady-state miss ratios are scaled by its own ratio for that loop, so a policy that keeps
+// part of the large loop is not penalized for it. The model closest to the measurement over all orders wins.
+enum class Policy {
+    Lru,
+    Fifo,
+    TreePlru,   // binary tree of direction bits; power-of-two ways only
+    BitPlru,    // one MRU bit per way, cleared when all are set (NRU)
+    Srrip,      // 2-bit re-reference prediction, insertion at "long"
+    Brrip,      // insertion at "distant" except every 32nd: the thrash-resistant half of adaptive DRRIP
+};
+
+static constexpr Policy policies[] = {Policy::Lru, Policy::Fifo, Policy::TreePlru, Policy::BitPlru, Policy::Srrip,
+                                      Policy::Brrip};
+
+static const char *policy_name(Policy policy) {
+    switch (policy) {
+        case Policy::Lru: return "lru";
+        case Policy::Fifo: return "fifo";
+        case Policy::TreePlru: return "tree-plru";
+        case Policy::BitPlru: return "bit-plru";
+        case Policy::Srrip: return "srrip";
+        case Policy::Brrip: return "brrip";
+    }
+    return "?";
+}
+
+// One set of `ways` ways under `policy`.
+struct PolicySet {
+    Policy policy;
+    size_t ways;
+    std::vector<int> lines;         // -1 = empty way
+    std::vector<uint64_t> state;    // LRU/FIFO: time of use/fill, bit-PLRU: MRU bit, RRIP: prediction value
+    std::vector<uint8_t> tree;      // tree-PLRU, heap order from 1: the victim is to the right if set
+    uint64_t clock = 0;
+    uint64_t fills = 0;
+
+    PolicySet(Policy policy, size_t ways) : policy(policy), ways(ways), lines(ways, -1), state(ways, 0), tree(ways, 0) {}
+
+    bool access(int line) {
+        ++clock;
+        for (size_t w = 0; w < ways; ++w) {
+            if (lines[w] == line) {
+                touch(w, true);
+                return true;
+            }
+        }
+        const size_t w = victim();
+        lines[w] = line;
+        touch(w, false);
+        return false;
+    }
+
+    size_t victim() {
+        for (size_t w = 0; w < ways; ++w)
+            if (lines[w] < 0) return w;
+        switch (policy) {
+            case Policy::Lru:
+            case Policy::Fifo:
+                return size_t(std::min_element(state.begin(), state.end()) - state.begin());
+            case Policy::TreePlru: {
+                size_t node = 1;
+                while (node < ways) node = 2 * node + tree[node];
+                return node - ways;
+            }
+            case Policy::BitPlru:
+                return size_t(std::find(state.begin(), state.end(), 0) - state.begin());
+            case Policy::Srrip:
+            case Policy::Brrip:
+                for (;;) {
+                    for (size_t w = 0; w < ways; ++w)
+                        if (state[w] >= 3) return w;
+                    for (auto &rrpv: state) ++rrpv;
+                }
+        }
+        return 0;
+    }
+
+    void touch(size_t w, bool hit) {
+        switch (policy) {
+            case Policy::Lru:
+                state[w] = clock;
+                break;
+            case Policy::Fifo:
+                if (!hit) state[w] = clock;
+                break;
+            case Policy::TreePlru:
+                // point every node on the way up away from the leaf just used
+                for (size_t node = w + ways; node > 1; node /= 2) tree[node / 2] = (node & 1) ? 0 : 1;
+                break;
+            case Policy::BitPlru:
+                state[w] = 1;
+                if (size_t(std::count(state.begin(), state.end(), 1)) == ways)
+                    for (size_t v = 0; v < ways; ++v) state[v] = v == w;
+                break;
+            case Policy::Srrip:
+                state[w] = hit ? 0 : 2;
+                break;
+            case Policy::Brrip:
+                state[w] = hit ? 0 : (fills++ % 32 == 0 ? 2 : 3);
+                break;
+        }
+    }
+};
+
+// Misses per access of `order` repeated in a loop, after the model has settled.
+static double model_miss_ratio(Policy policy, size_t ways, const std::vector<int> &order) {
+    PolicySet set(policy, ways);
+    size_t misses = 0;
+    for (int lap = 0; lap < 64; ++lap)
+        for (int line: order)
+            if (!set.access(line) && lap >= 32) ++misses;
+    return double(misses) / double(32 * order.size());
+}
+
+// A line holds policy_slots nodes 8 B apart, so an order may visit a line that many times per lap.
+static constexpr size_t policy_slots = 8;
+
+struct PolicyOrder {
+    std::string name;
+    std::vector<int> lines;
+};
+
+// The canonical orders over lines 0..2 x ways - 1: two references, then the scored ones.
+static std::vector<PolicyOrder> policy_orders(size_t ways) {
+    const int w = int(ways);
+    auto loop = [](int n) {
+        std::vector<int> order(n);
+        for (int i = 0; i < n; ++i) order[i] = i;
+        return order;
+    };
+    std::vector<PolicyOrder> orders{{"loop_w",    loop(w)},
+                                    {"loop_2w",   loop(2 * w)},
+                                    {"loop_w+1",  loop(w + 1)},
+                                    {"loop_w+2",  loop(w + 2)},
+                                    {"loop_3w/2", loop(w + w / 2)}};
+
+    // a hot line between every `gap` others: LRU and PLRU keep it, FIFO ages it out
+    const int gap = std::max(1, (w + int(policy_slots) - 1) / int(policy_slots));
+    std::vector<int> hot;
+    for (int i = 1; i <= w; ++i) {
+        if ((i - 1) % gap == 0) hot.push_back(0);
+        hot.push_back(i);
+    }
+    orders.push_back({"hot", hot});
+
+    // ways / 2 lines used twice, then a scan of `ways` lines used once: RRIP protects the reused half from the scan
+    std::vector<int> scan;
+    for (int pass = 0; pass < 2; ++pass)
+        for (int i = 0; i < w / 2; ++i) scan.push_back(i);
+    for (int i = w / 2; i < w / 2 + w; ++i) scan.push_back(i);
+    orders.push_back({"scan", scan});
+
+    // up over ways + 1 lines and back down: LRU hits on the way back
+    std::vector<int> saw = loop(w + 1);
+    for (int i = w - 1; i > 0; --i) saw.push_back(i);
+    orders.push_back({"sawtooth", saw});
+    return orders;
+}
+
+// Chase `order` (indices into `line_offsets`) in that fixed order, the k-th visit of a line on its k-th node.
+static NOINLINE double measure_order(
+        const Buffer &buffer,
+        const std::vector<size_t> &line_offsets,
+        const std::vector<int> &order,
+        uint64_t total_accesses,
+        int trials = 3
+) {
+    auto raw = (unsigned char *) buffer.data();
+    if (raw == nullptr || order.empty()) return 0.0;
+
+    std::vector<Node *> nodes;
+    nodes.reserve(order.size());
+    std::vector<size_t> visits(line_offsets.size(), 0);
+    for (int line: order)
+        nodes.push_back((Node *) (raw + line_offsets[line] + sizeof(Node) * visits[line]++));
+    for (size_t i = 0; i + 1 < nodes.size(); ++i)
+        nodes[i]->next = nodes[i + 1];
+    nodes.back()->next = nodes.front();
+
+    std::vector<double> results;
+    results.reserve(trials);
+    while (more_trials(results, trials)) {
+        PointerChaseKernel kernel{nodes.front()};
+        double ns = measure(std::min<std::uint64_t>(200000, total_accesses), total_accesses, kernel);
+        results.push_back(ns / (double) total_accesses);
+    }
+    return median(results);
+}
+
+static void detect_policy_level(int level, size_t ways, size_t stride, const Buffer &buffer, const Options &opts,
+                                Report &report) {
+    const std::string name = "policy_l" + std::to_string(level);
+    std::vector<size_t> line_offsets(2 * ways);
+    for (size_t i = 0; i < line_offsets.size(); ++i) line_offsets[i] = i * stride;
+
+    const auto orders = policy_orders(ways);
+    std::vector<double> times;
+    for (const auto &order: orders)
+        times.push_back(measure_order(buffer, line_offsets, order.lines, opts.total_accesses, opts.trials));
+
+    const double hit = times[0], miss = times[1];
+    if (opts.verbose) {
+        std::cout << "\nReplacement policy (L" << level << ", " << ways << " ways, lines " << stride << " B apart, "
+                  << timer_unit() << "/access):\norder\ttime\tmiss";
+        for (Policy policy: policies) std::cout << "\t" << policy_name(policy);
+        std::cout << "\n";
+    }
+    report.estimates.emplace_back(name + "_ways", double(ways));
+    report.estimates.emplace_back(name + "_hit", hit);
+    report.estimates.emplace_back(name + "_miss", miss);
+    if (miss < 1.3 * hit) {
+        report.notes.emplace_back(name, "no latency step between ways and 2 x ways lines of one set");
+        return;
+    }
+
+    std::vector<double> error(std::size(policies), 0.0);
+    std::vector<double> reference(std::size(policies));
+    for (size_t p = 0; p < std::size(policies); ++p)
+        reference[p] = model_miss_ratio(policies[p], ways, orders[1].lines);
+    const bool tree = (ways & (ways - 1)) == 0;
+
+    for (size_t i = 2; i < orders.size(); ++i) {
+        const double measured = std::clamp((times[i] - hit) / (miss - hit), 0.0, 1.0);
+        report.estimates.emplace_back(name + "_miss_" + orders[i].name, measured);
+        if (opts.verbose) std::cout << orders[i].name << "\t" << times[i] << "\t" << measured;
+        for (size_t p = 0; p < std::size(policies); ++p) {
+            const double predicted = reference[p] > 0
+                                     ? std::min(1.0, model_miss_ratio(policies[p], ways, orders[i].lines) / reference[p])
+                                     : 1.0;
+            error[p] += std::abs(measured - predicted);
+            if (opts.verbose && policies[p] == Policy::TreePlru && !tree) std::cout << "\t-";
+            else if (opts.verbose) std::cout << "\t" << predicted;
+        }
+        if (opts.verbose) std::cout << "\n";
+    }
+
+    size_t best = std::size(policies);
+    for (size_t p = 0; p < std::size(policies); ++p) {
+        if (policies[p] == Policy::TreePlru && !tree) continue;
+        const double agreement = 1.0 - error[p] / double(orders.size() - 2);
+        report.estimates.emplace_back(name + "_agreement_" + policy_name(policies[p]), agreement);
+        if (best == std::size(policies) || error[p] < error[best]) best = p;
+    }
+    report.estimates.emplace_back(name + "_agreement", 1.0 - error[best] / double(orders.size() - 2));
+    report.notes.emplace_back(name + "_model", policy_name(policies[best]));
+}
+
+static void detect_policy(size_t page_size, const Options &opts, Report &report) {
+    const size_t l1_ways = estimate(report, "l1_ways") > 0 ? size_t(estimate(report, "l1_ways")) : os_l1_ways();
+    if (l1_ways < 2) {
+        report.notes.emplace_back("policy_l1", "L1 associativity unknown");
+    } else {
+        const Buffer buffer(2 * l1_ways * page_size, page_size, opts.pages_policy);
+        if (buffer.data() == nullptr) report.notes.emplace_back("policy_l1", "no memory for the buffer");
+        else detect_policy_level(1, l1_ways, page_size, buffer, opts, report);
+    }
+
+    // outer levels: lines one way size apart, at most 2 MB as in the set probe; a hashed index scatters them and
+    // the 2 x ways loop shows no step
+    const size_t huge_page = 2ULL << 20;
+    for (const auto &cache: reported_caches(current_cpu(), nullptr)) {
+        if (cache.level < 2 || cache.type == "Instruction" || cache.bytes == 0 || cache.ways < 2) continue;
+        const std::string name = "policy_l" + std::to_string(cache.level);
+        const size_t stride = std::min(power_of_two_above(cache.bytes / cache.ways), huge_page);
+        const Buffer buffer(2 * cache.ways * stride, huge_page, opts.pages_policy);
+        if (buffer.data() == nullptr) {
+            report.notes.emplace_back(name, "no memory for the buffer");
+        } else if (buffer.backend() == PageBackend::Default && stride > page_size) {
+            report.notes.emplace_back(name, "needs huge pages (--pages policy=thp|2m)");
+        } else {
+            detect_policy_level(cache.level, cache.ways, stride, buffer, opts, report);
+        }
+    }
+}
+
+// *------------------------------------------------------------------------------------*
+// |                                   TLB PROBE                                        |
+// *------------------------------------------------------------------------------------*
+// Chases one line per `spacing` bytes. The line offset rotates inside each page so the lines spread over all
+// cache sets; spacing == 64 gives the compact control ring with the same cache footprint and almost no TLB
+// footprint.
+static NOINLINE double measure_page_chase(
+        size_t count,
+        size_t spacing,
+        PageBackend pages,
+        uint64_t total_accesses,
+        int trials = 3,
+        std::vector<double> *samples = nullptr,
+        PageBackend *obtained = nullptr
+) {
+    const size_t line = 64;
+    Buffer buffer(count * spacing, std::max(spacing, line), pages);
+    auto *base = static_cast<unsigned char *>(buffer.data());
+    if (base == nullptr) return 0.0;
+    if (obtained) *obtained = buffer.backend();
+
+    const size_t lines_per_page = std::max<size_t>(std::min<size_t>(spacing, 4096) / line, 1);
+
+    std::vector<double> results;
+    results.reserve(trials);
+
+    std::vector<size_t> order(count);
+    for (int t = 0; more_trials(results, trials); ++t) {
+        random_permutation(order.data(), count, 1000 + t);
+
+        auto node = [&](size_t i) { return (Node *) (base + i * spacing + (i % lines_per_page) * line); };
+        link_cycle(count, [&](size_t i, size_t j) { node(order[i])->next = node(order[j]); });
+
+        PointerChaseKernel kernel{node(order.front())};
+        double ns = measure(200000, total_accesses, kernel);
+
+        results.push_back(ns / (double) total_accesses);
+    }
+
+    if (samples) *samples = results;
+    return median(results);
+}
+
+struct TlbLevel {
+    size_t entries;
+    double penalty;         // extra time per access once this level is exceeded
+    size_t entries_lo, entries_hi;
+};
+
+// Probes one page kind; returns the TLB levels found and leaves both curves in the report.
+static std::vector<TlbLevel> detect_tlb(
+        const std::string &kind,
+        size_t page_bytes,
+        PageBackend backend,
+        size_t max_pages,
+        const Options &opts,
+        Report *report,
+        PageBackend *obtained,
+        std::string *reason
+) {
+    std::vector<SizePoint> probe, control, adjusted;
+
+    if (opts.verbose) {
+        std::cout << "\nTLB probe (" << (page_bytes / 1024) << " KB pages):\n";
+        std::cout << "pages\t" << timer_unit() << "/access\tcontrol\tpages\n";
+    }
+
+    *obtained = backend;
+    size_t last = 0;
+    for (int i = 0;; ++i) {
+        const auto pages = size_t(4.0 * std::pow(2.0, i / 4.0));
+        if (pages > max_pages) break;
+        if (pages == last) continue;
+        last = pages;
+
+        std::vector<double> samples, control_samples;
+        PageBackend got = backend;
+        double ns = measure_page_chase(pages, page_bytes, backend, opts.total_accesses, opts.trials, &samples, &got);
+        double base = measure_page_chase(pages, 64, PageBackend::Default, opts.total_accesses, opts.trials,
+                                         &control_samples);
+        if (got < *obtained) *obtained = got;
+
+        probe.push_back({pages, ns, std::move(samples), got});
+        control.push_back({pages, base, std::move(control_samples)});
+        // the probe with the cache component swapped for the smallest control, i.e. L1 hit + TLB cost
+        adjusted.push_back({pages, control.front().per_access + ns - base});
+
+        if (opts.verbose) {
+            std::cout << pages << "\t" << ns << "\t\t" << base << "\t" << page_backend_name(got) << "\n";
+        }
+    }
+
+    Segmentation seg;
+    const auto levels = detect_levels(adjusted, 1.3, reason, &seg);
+
+    if (report) {
+        report->curves.push_back({kind, "pages", probe, {
+                {"min_step_ratio", 1.3}, {"noise", seg.noise}, {"penalty", seg.penalty}}, backend});
+        report->curves.push_back({kind + "_control", "pages", control, {}});
+    }
+
+    auto extra = [&](size_t from_pages, size_t to_pages) {
+        std::vector<double> vals;
+        for (size_t i = 0; i < probe.size(); ++i) {
+            if (probe[i].bytes > from_pages && (to_pages == 0 || probe[i].bytes <= to_pages))
+                vals.push_back(probe[i].per_access - control[i].per_access);
+        }
+        return median(vals);
+    };
+
+    std::vector<TlbLevel> tlb;
+    for (size_t l = 0; l + 1 < levels.size(); ++l) {
+        const size_t from = l == 0 ? 0 : levels[l - 1].bytes;
+        tlb.push_back({levels[l].bytes, extra(levels[l].bytes, levels[l + 1].bytes) - extra(from, levels[l].bytes),
+                       levels[l].bytes_lo, levels[l].bytes_hi});
+    }
+    return tlb;
+}
+
+static void detect_tlbs(size_t page_size, const Options &opts, Report &report) {
+    struct Kind {
+        const char *name;
+        size_t page_bytes;
+        PageBackend backend;
+        size_t max_pages;
+    };
+
+    const size_t huge = 2ULL << 20;
+    const size_t max_bytes = opts.max_bytes != 0 ? opts.max_bytes : 512ULL * 1024 * 1024;
+    const Kind kinds[] = {
+            {"base", page_size, PageBackend::Default, 16384},
+            {"huge", huge, PageBackend::Huge2M, std::max<size_t>(max_bytes / huge, 4)},
+    };
+
+    for (const auto &kind: kinds) {
+        const std::string prefix = std::string("tlb_") + kind.name;
+
+        PageBackend obtained = kind.backend;
+        std::string reason;
+        auto levels = detect_tlb(prefix, kind.page_bytes, kind.backend, kind.max_pages, opts, &report, &obtained,
+                                 &reason);
+
+        // a huge-page run that ended up on base pages measures nothing new
+        const bool got_pages = kind.backend == PageBackend::Default || obtained != PageBackend::Default;
+        report.estimates.emplace_back(prefix + "_page_bytes", got_pages ? double(kind.page_bytes) : 0.0);
+        if (!got_pages) continue;
+
+        report.estimates.emplace_back(prefix + "_levels", double(levels.size()));
+        if (levels.empty()) report.notes.emplace_back(prefix, reason);
+        for (size_t l = 0; l < levels.size(); ++l) {
+            const std::string level = prefix + "_l" + std::to_string(l + 1);
+            report.estimates.emplace_back(level + "_entries", double(levels[l].entries));
+            report.estimates.emplace_back(level + "_entries_lo", double(levels[l].entries_lo));
+            report.estimates.emplace_back(level + "_entries_hi", double(levels[l].entries_hi));
+            report.estimates.emplace_back(level + "_penalty", levels[l].penalty);
+        }
+    }
+}
+
+
+// *------------------------------------------------------------------------------------*
+// |                               BANDWIDTH PROBE                                      |
+// *------------------------------------------------------------------------------------*
+static const char *bandwidth_kernel_name(BandwidthKernel kernel) {
+    switch (kernel) {
+        case BandwidthKernel::Read:
+            return "read";
+        case BandwidthKernel::Write:
+            return "write";
+        case BandwidthKernel::Copy:
+            return "copy";
+        default:
+            return "nt_write";
+    }
+}
+
+static const char *bandwidth_unit() {
+    return g_timer.backend == TimerBackend::Chrono ? "GB/s" : "B/cycle";
+}
+
+// Bytes moved per timer unit (GB/s for ns); copy counts both the read and the written byte, as STREAM does.
+static NOINLINE double measure_bandwidth(
+        const IsaInfo &isa,
+        BandwidthKernel which,
+        size_t bytes,
+        uint64_t total_accesses,
+        int trials = 3,
+        std::vector<double> *samples = nullptr
+) {
+    bytes = align_up(bytes, 256);
+    Buffer src(bytes, 64, PageBackend::Default);
+    Buffer dst(bytes, 64, PageBackend::Default);
+    if (src.data() == nullptr || dst.data() == nullptr) return 0.0;
+
+    auto *a = static_cast<unsigned char *>(src.data());
+    auto *b = static_cast<unsigned char *>(dst.data());
+    std::memset(a, 1, bytes);
+
+    // as many bytes per measurement as the latency probes touch lines
+    const size_t passes = std::max<size_t>(1, total_accesses * 64 / bytes);
+    const double moved = double(passes) * double(bytes) * (which == BandwidthKernel::Copy ? 2.0 : 1.0);
+
+    // read works on src, the stores on dst
+    StreamKernel kernel{isa.kernels[size_t(which)], b, a, bytes};
+
+    std::vector<double> results;
+    results.reserve(trials);
+
+    for (int t = 0; more_trials(results, trials); ++t) {
+        double ns = measure(1, passes, kernel);
+        results.push_back(ns > 0.0 ? moved / ns : 0.0);
+    }
+
+    if (samples) *samples = results;
+    return median(results);
+}
+
+// Spin barrier for a fixed set of threads; abort() releases every waiter for good (a thread that failed).
+class SpinBarrier {
+public:
+    explicit SpinBarrier(size_t threads) : threads_(threads) {}
+
+    // false once aborted
+    bool wait() {
+        const size_t generation = generation_.load();
+        if (arrived_.fetch_add(1) + 1 == threads_) {
+            arrived_.store(0);
+            generation_.fetch_add(1);
+        } else {
+            while (generation_.load() == generation && !aborted_.load()) {}
+        }
+        return !aborted_.load();
+    }
+
+    void abort() { aborted_.store(true); }
+
+private:
+    const size_t threads_;
+    std::atomic<size_t> arrived_{0};
+    std::atomic<size_t> generation_{0};
+    std::atomic<bool> aborted_{false};
+};
+
+// Runs the same kernel on every worker CPU at once. Buffers are allocated and touched before the first barrier,
+// and every trial starts behind a barrier of its own, so the timed windows overlap; a trial's bandwidth is the
+// bytes all threads moved over the union of their windows (first start to last end on steady_clock, converted to
+// timer units at the rate the threads' own timers ran in that trial: per-thread perf cycles share no clock). The
+// trial count is fixed: threads stopping on their own schedule would leave the last ones running alone.
+static double measure_bandwidth_all(
+        const IsaInfo &isa,
+        BandwidthKernel which,
+        size_t bytes,
+        const std::vector<int> &cpus,
+        const Options &opts,
+        std::vector<double> *samples
+) {
+    using Clock = std::chrono::steady_clock;
+    bytes = align_up(bytes, 256);
+    const size_t passes = std::max<size_t>(1, opts.total_accesses * 64 / bytes);
+    const double moved = double(passes) * double(bytes) * (which == BandwidthKernel::Copy ? 2.0 : 1.0);
+    const size_t trials = size_t(std::max(opts.trials, 1));
+
+    std::vector<std::vector<Clock::time_point>> starts(cpus.size(), std::vector<Clock::time_point>(trials));
+    std::vector<std::vector<Clock::time_point>> ends(cpus.size(), std::vector<Clock::time_point>(trials));
+    std::vector<std::vector<double>> units(cpus.size(), std::vector<double>(trials));
+    std::vector<std::exception_ptr> errors(cpus.size());
+    SpinBarrier barrier(cpus.size());
+
+    std::vector<std::thread> workers;
+    workers.reserve(cpus.size());
+    const int mem_node = g_mem_node;
+    for (size_t i = 0; i < cpus.size(); ++i) {
+        workers.emplace_back([&, i] {
+            g_mem_node = mem_node;
+            try {
+#ifdef __linux__
+                pin_to_cpu(cpus[i]);
+#endif
+                Buffer src(bytes, 64, PageBackend::Default);
+                Buffer dst(bytes, 64, PageBackend::Default);
+                if (src.data() == nullptr || dst.data() == nullptr)
+                    throw std::runtime_error("Нет памяти для буферов пропускной способности");
+                std::memset(src.data(), 1, bytes);
+
+                // read works on src, the stores on dst
+                StreamKernel kernel{isa.kernels[size_t(which)], static_cast<unsigned char *>(dst.data()),
+                                    static_cast<const unsigned char *>(src.data()), bytes};
+                do_not_optimize(kernel(1));
+
+                for (size_t t = 0; t < trials; ++t) {
+                    if (!barrier.wait()) return;
+                    starts[i][t] = Clock::now();
+                    units[i][t] = measure(0, passes, kernel);
+                    ends[i][t] = Clock::now();
+                }
+            } catch (...) {
+                errors[i] = std::current_exception();
+                barrier.abort();
+            }
+        });
+    }
+
+    for (auto &worker: workers) worker.join();
+    for (auto &error: errors)
+        if (error) std::rethrow_exception(error);
+
+    std::vector<double> results;
+    for (size_t t = 0; t < trials; ++t) {
+        Clock::time_point first = starts[0][t], last = ends[0][t];
+        double units_per_ns = 0.0;
+        for (size_t i = 0; i < cpus.size(); ++i) {
+            first = std::min(first, starts[i][t]);
+            last = std::max(last, ends[i][t]);
+            const std::chrono::duration<double, std::nano> own = ends[i][t] - starts[i][t];
+            if (own.count() > 0.0) units_per_ns += units[i][t] / own.count() / double(cpus.size());
+        }
+        const double window = std::chrono::duration<double, std::nano>(last - first).count() * units_per_ns;
+        results.push_back(window > 0.0 ? moved * double(cpus.size()) / window : 0.0);
+    }
+
+    if (samples) *samples = results;
+    return median(results);
+}
+
+// Cache level capacities the bandwidth curves are split by: the measured hierarchy if there is one,
+// otherwise what the OS reports, otherwise the L1 estimate alone.
+static std::vector<size_t> cache_boundaries(const Report &report) {
+    std::vector<size_t> sizes;
+    for (const auto &level: report.levels)
+        if (level.bytes != 0) sizes.push_back(level.bytes);
+    if (!sizes.empty()) return sizes;
+
+    sizes = os_cache_sizes();
+    if (!sizes.empty()) return sizes;
+
+    const auto l1 = size_t(estimate(report, "l1_bytes"));
+    if (l1 != 0) sizes.push_back(l1);
+    return sizes;
+}
+
+// Median bandwidth of the points well inside each level: up to half of its capacity for caches,
+// beyond twice the last cache for DRAM (the largest point if the sweep stops earlier).
+static std::vector<double> bandwidth_per_level(const std::vector<SizePoint> &pts, const std::vector<size_t> &caches) {
+    std::vector<double> out;
+    size_t lower = 0;
+    for (size_t cap: caches) {
+        std::vector<double> vals;
+        for (const auto &p: pts)
+            if (p.bytes > lower && p.bytes <= cap / 2) vals.push_back(p.per_access);
+        if (vals.empty()) {
+            for (const auto &p: pts)
+                if (p.bytes > lower && p.bytes <= cap) vals.push_back(p.per_access);
+        }
+        out.push_back(median(vals));
+        lower = cap;
+    }
+
+    std::vector<double> vals;
+    for (const auto &p: pts)
+        if (p.bytes > 2 * lower) vals.push_back(p.per_access);
+    if (vals.empty() && !pts.empty()) vals.push_back(pts.back().per_access);
+    out.push_back(median(vals));
+    return out;
+}
+
+static std::vector<const IsaInfo *> selected_isas(const Options &opts) {
+    std::vector<const IsaInfo *> isas;
+    for (const auto &info: isa_table) {
+        if (!isa_supported(info.isa)) continue;
+        if (opts.isa == "auto" || opts.isa == "all" || opts.isa == info.name) isas.push_back(&info);
+    }
+    if (opts.isa == "auto" && !isas.empty()) {
+        const IsaInfo *widest = isas.front();
+        for (auto *info: isas)
+            if (info->bits > widest->bits) widest = info;
+        isas = {widest};
+    }
+    if (isas.empty()) throw std::runtime_error("Набор инструкций " + opts.isa + " не поддерживается");
+    return isas;
+}
+
+static void detect_bandwidth(const Options &opts, Report &report) {
+    const size_t max_bytes = hierarchy_max_bytes(opts);
+    const auto sizes = make_log_sizes_grid(4 * 1024, max_bytes, 2);
+    const auto caches = cache_boundaries(report);
+
+#ifdef __linux__
+    const std::vector<int> cpus = opts.cpus.empty() ? allowed_cpus() : opts.cpus;
+#else
+    const std::vector<int> cpus(std::max(1u, std::thread::hardware_concurrency()), -1);
+#endif
+    report.estimates.emplace_back("bw_threads", double(cpus.size()));
+
+    for (const IsaInfo *isa: selected_isas(opts)) {
+        report.estimates.emplace_back(std::string("bw_") + isa->name + "_bits", double(isa->bits));
+
+        for (bool all: {false, true}) {
+            for (auto which: {BandwidthKernel::Read, BandwidthKernel::Write, BandwidthKernel::Copy,
+                              BandwidthKernel::NtWrite}) {
+                const std::string name = std::string("bw_") + isa->name + "_" + bandwidth_kernel_name(which)
+                                         + (all ? "_all" : "_1t");
+
+                if (opts.verbose) {
+                    std::cout << "\nBandwidth probe (" << isa->name << " " << bandwidth_kernel_name(which) << ", "
+                              << (all ? std::to_string(cpus.size()) + " threads" : std::string("1 thread"))
+                              << "):\n";
+                    std::cout << "Size(KB)\t" << bandwidth_unit() << "\n";
+                }
+
+                std::vector<SizePoint> pts;
+                for (size_t bytes: sizes) {
+                    // the per-thread working set stays the same; skip what would not fit in memory all together
+                    if (all && bytes * cpus.size() > std::max(max_bytes, bytes)) break;
+
+                    std::vector<double> samples;
+                    double bw = all ? measure_bandwidth_all(*isa, which, bytes, cpus, opts, &samples)
+                                    : measure_bandwidth(*isa, which, bytes, opts.total_accesses, opts.trials,
+                                                        &samples);
+                    pts.push_back({bytes, bw, std::move(samples)});
+
+                    if (opts.verbose) {
+                        std::cout << std::to_string(bytes / 1024) << "\t\t" << bw << "\n";
+                    }
+                }
+
+                const auto levels = bandwidth_per_level(pts, caches);
+                for (size_t l = 0; l < levels.size(); ++l) {
+                    const std::string level = l + 1 == levels.size() ? "dram" : "l" + std::to_string(l + 1);
+                    report.estimates.emplace_back(name + "_" + level, levels[l]);
+                }
+                report.curves.push_back({name, "bytes", std::move(pts), {}});
+            }
+        }
+    }
+}
+
+
+// *------------------------------------------------------------------------------------*
+// |                          MEMORY-LEVEL PARALLELISM PROBE                            |
+// *------------------------------------------------------------------------------------*
+static constexpr size_t mlp_chains[] = {1, 2, 3, 4, 6, 8, 10, 12, 16, 20, 24, 32};
+
+template<size_t N>
+static double chase_chains(Node *const *heads, size_t rounds) {
+    MultiChaseKernel<N> kernel;
+    std::copy(heads, heads + N, kernel.heads);
+    return measure(std::min<size_t>(rounds, 200000 / N + 1), rounds, kernel);
+}
+
+// indexed like mlp_chains
+static double (*const chase_chains_table[])(Node *const *, size_t) = {
+        chase_chains<1>, chase_chains<2>, chase_chains<3>, chase_chains<4>, chase_chains<6>, chase_chains<8>,
+        chase_chains<10>, chase_chains<12>, chase_chains<16>, chase_chains<20>, chase_chains<24>, chase_chains<32>,
+};
+
+// All lines of a `bytes` buffer in one random order, cut into `mlp_chains[chains_idx]` rings of equal length,
+// chased in lockstep. Returns time per access; with N chains the core may keep up to N misses in flight.
+static NOINLINE double measure_mlp(
+        size_t bytes,
+        size_t chains_idx,
+        uint64_t total_accesses,
+        int trials = 3,
+        PageBackend pages = PageBackend::Default,
+        std::vector<double> *samples = nullptr,
+        PageBackend *obtained = nullptr
+) {
+    const size_t line = 64;
+    const size_t chains = mlp_chains[chains_idx];
+    const size_t lines = std::max(bytes / line, chains * 2);
+
+    Buffer buffer(lines * line, line, pages);
+    auto *base = static_cast<unsigned char *>(buffer.data());
+    if (base == nullptr) return 0.0;
+    if (obtained) *obtained = buffer.backend();
+
+    const size_t rounds = std::max<size_t>(total_accesses / chains, 1);
+
+    std::vector<double> results;
+    results.reserve(trials);
+
+    std::vector<size_t> order(lines);
+    for (int t = 0; more_trials(results, trials); ++t) {
+        random_permutation(order.data(), lines, 2000 + t);
+
+        const size_t per_chain = lines / chains;
+        std::vector<Node *> heads(chains);
+        for (size_t c = 0; c < chains; ++c) {
+            const size_t *ring = order.data() + c * per_chain;
+            link_cycle(per_chain, [&](size_t i, size_t j) {
+                ((Node *) (base + ring[i] * line))->next = (Node *) (base + ring[j] * line);
+            });
+            heads[c] = (Node *) (base + ring[0] * line);
+        }
+
+        double ns = chase_chains_table[chains_idx](heads.data(), rounds);
+        results.push_back(ns / double(rounds * chains));
+    }
+
+    if (samples) *samples = results;
+    return median(results);
+}
+
+static void detect_mlp(const Options &opts, Report &report) {
+    // one working set well inside every cache level past L1, and one in DRAM
+    std::vector<std::pair<std::string, size_t>> sets;
+    const auto caches = cache_boundaries(report);
+    for (size_t l = 1; l < caches.size(); ++l) {
+        if (caches[l] / 2 > 2 * caches[l - 1]) sets.emplace_back("l" + std::to_string(l + 1), caches[l] / 2);
+    }
+    const size_t dram = std::max(hierarchy_max_bytes(opts), caches.empty() ? 0 : 4 * caches.back());
+    sets.emplace_back("dram", dram);
+
+    for (const auto &[level, bytes]: sets) {
+        const std::string name = "mlp_" + level;
+
+        if (opts.verbose) {
+            std::cout << "\nMLP probe (" << level << ", " << (bytes / 1024) << " KB):\n";
+            std::cout << "chains\t" << timer_unit() << "/access\tspeedup\tpages\n";
+        }
+
+        std::vector<SizePoint> pts;
+        double best = 0.0;
+        for (size_t i = 0; i < std::size(mlp_chains); ++i) {
+            std::vector<double> samples;
+            PageBackend got = opts.pages_mlp;
+            double ns = measure_mlp(bytes, i, opts.total_accesses, opts.trials, opts.pages_mlp, &samples, &got);
+            pts.push_back({mlp_chains[i], ns, std::move(samples), got});
+
+            const double speedup = ns > 0.0 ? pts.front().per_access / ns : 0.0;
+            best = std::max(best, speedup);
+
+            if (opts.verbose) {
+                std::cout << mlp_chains[i] << "\t" << ns << "\t\t" << speedup << "\t" << page_backend_name(got) << "\n";
+            }
+        }
+
+        // the fewest chains that get within 10% of the best overlap is the number of misses the level sustains
+        size_t chains = 1;
+        for (const auto &p: pts) {
+            if (p.per_access > 0.0 && pts.front().per_access / p.per_access >= 0.9 * best) {
+                chains = p.bytes;
+                break;
+            }
+        }
+
+        report.estimates.emplace_back(name + "_bytes", double(bytes));
+        report.estimates.emplace_back(name + "_latency", pts.front().per_access);
+        report.estimates.emplace_back(name + "_speedup", best);
+        report.estimates.emplace_back(name + "_chains", double(chains));
+        report.curves.push_back({name, "chains", std::move(pts), {{"saturation_ratio", 0.9}}, opts.pages_mlp});
+    }
+}
+
+
+// *------------------------------------------------------------------------------------*
+// |                                PREFETCHER PROBE                                    |
+// *------------------------------------------------------------------------------------*
+enum class PrefetchPattern {
+    Random,         // every line in random order: nothing to predict
+    Forward,        // ascending fixed stride
+    Backward,       // descending fixed stride
+    PageShuffled,   // ascending lines inside a page, pages in random order
+};
+
+static constexpr size_t prefetch_strides[] = {64, 128, 256, 512, 1024, 2048, 4096};
+
+// Visiting order of the `lines` lines of a buffer. A strided order covers every line: it makes `stride / 64`
+// passes, each starting one line further, so the footprint does not shrink as the stride grows.
+static std::vector<size_t> prefetch_order(PrefetchPattern pattern, size_t lines, size_t stride_lines,
+                                          size_t page_lines, uint64_t seed) {
+    std::vector<size_t> order;
+    order.reserve(lines);
+
+    switch (pattern) {
+        case PrefetchPattern::Random:
+            order.resize(lines);
+            random_permutation(order.data(), lines, seed);
+            break;
+        case PrefetchPattern::Forward:
+        case PrefetchPattern::Backward:
+            for (size_t first = 0; first < stride_lines; ++first)
+                for (size_t i = first; i < lines; i += stride_lines) order.push_back(i);
+            if (pattern == PrefetchPattern::Backward) std::reverse(order.begin(), order.end());
+            break;
+        case PrefetchPattern::PageShuffled: {
+            std::vector<size_t> pages((lines + page_lines - 1) / page_lines);
+            random_permutation(pages.data(), pages.size(), seed);
+            for (size_t p: pages)
+                for (size_t i = p * page_lines; i < std::min(lines, (p + 1) * page_lines); ++i) order.push_back(i);
+            break;
+        }
+    }
+    return order;
+}
+
+// Dependent chase over the lines of a `bytes` buffer in the given order: the next address is only known once the
+// load returns, so anything faster than the random order comes from a prefetcher.
+static NOINLINE double measure_prefetch(
+        size_t bytes,
+        PrefetchPattern pattern,
+        size_t stride,
+        size_t page_size,
+        uint64_t total_accesses,
+        int trials = 3,
+        PageBackend pages = PageBackend::Default,
+        std::vector<double> *samples = nullptr,
+        PageBackend *obtained = nullptr
+) {
+    const size_t line = 64;
+    const size_t lines = std::max<size_t>(bytes / line, 2);
+
+    Buffer buffer(lines * line, page_size, pages);
+    auto *base = static_cast<unsigned char *>(buffer.data());
+    if (base == nullptr) return 0.0;
+    if (obtained) *obtained = buffer.backend();
+
+    std::vector<double> results;
+    results.reserve(trials);
+
+    for (int t = 0; more_trials(results, trials); ++t) {
+        const auto order = prefetch_order(pattern, lines, std::max<size_t>(stride / line, 1), page_size / line,
+                                          3000 + t);
+        link_cycle(order.size(), [&](size_t i, size_t j) {
+            ((Node *) (base + order[i] * line))->next = (Node *) (base + order[j] * line);
+        });
+
+        PointerChaseKernel kernel{(Node *) (base + order.front() * line)};
+        double ns = measure(std::min<uint64_t>(lines, 200000), total_accesses, kernel);
+
+        results.push_back(ns / (double) total_accesses);
+    }
+
+    if (samples) *samples = results;
+    return median(results);
+}
+
+#if defined(__linux__) && defined(HAVE_TSC)
+// Intel MSR 0x1A4 (MISC_FEATURE_CONTROL): bit 0 L2 streamer, 1 L2 adjacent line, 2 DCU streamer, 3 DCU IP.
+static constexpr uint32_t prefetch_msr = 0x1a4;
+static constexpr uint64_t prefetch_msr_disable_all = 0xf;
+
+static bool cpu_is_intel() {
+    return cpu_vendor() == "GenuineIntel";
+}
+
+// Sets the prefetcher control MSR on the given CPUs and restores the previous values on destruction. Every CPU is
+// opened and read before the first write, and a failed write restores the CPUs already written before throwing,
+// so no CPU is left with its prefetchers disabled.
+class PrefetchMsrGuard {
+public:
+    PrefetchMsrGuard(const std::vector<int> &cpus, uint64_t value) {
+        if (!cpu_is_intel()) throw std::runtime_error("Управление предвыборкой через MSR поддерживается только на Intel");
+
+        for (int cpu: cpus) {
+            const std::string path = "/dev/cpu/" + std::to_string(cpu) + "/msr";
+            const int fd = open(path.c_str(), O_RDWR);
+            if (fd < 0) {
+                const int err = errno;
+                restore(0);
+                throw std::runtime_error("Нет доступа к " + path + " (нужны root и модуль msr): " +
+                                         std::strerror(err));
+            }
+
+            uint64_t old = 0;
+            if (pread(fd, &old, sizeof(old), prefetch_msr) != sizeof(old)) {
+                const int err = errno;
+                close(fd);
+                restore(0);
+                throw std::runtime_error("Не удалось прочитать MSR 0x1a4 на CPU " + std::to_string(cpu) + ": " +
+                                         std::strerror(err));
+            }
+            saved_.push_back({fd, old});
+        }
+
+        for (size_t i = 0; i < saved_.size(); ++i) {
+            const auto &[fd, old] = saved_[i];
+            const uint64_t set = (old & ~prefetch_msr_disable_all) | value;
+            if (pwrite(fd, &set, sizeof(set), prefetch_msr) != sizeof(set)) {
+                const int err = errno;
+                restore(i);
+                throw std::runtime_error("Не удалось записать MSR 0x1a4 на CPU " + std::to_string(cpus[i]) + ": " +
+                                         std::strerror(err));
+            }
+        }
+    }
+
+    ~PrefetchMsrGuard() {
+        restore(saved_.size());
+    }
+
+    PrefetchMsrGuard(const PrefetchMsrGuard &) = delete;
+    PrefetchMsrGuard &operator=(const PrefetchMsrGuard &) = delete;
+
+private:
+    // Writes the saved values back to the first `written` CPUs and closes every fd.
+    void restore(size_t written) {
+        for (size_t i = 0; i < saved_.size(); ++i) {
+            const auto &[fd, old] = saved_[i];
+            if (i < written && pwrite(fd, &old, sizeof(old), prefetch_msr) != sizeof(old)) {
+                std::cerr << "Не удалось восстановить MSR 0x1a4: " << std::strerror(errno) << "\n";
+            }
+            close(fd);
+        }
+        saved_.clear();
+    }
+
+    std::vector<std::pair<int, uint64_t>> saved_;
+};
+#else
+static constexpr uint64_t prefetch_msr_disable_all = 0xf;
+
+class PrefetchMsrGuard {
+public:
+    PrefetchMsrGuard(const std::vector<int> &, uint64_t) {
+        throw std::runtime_error("Управление предвыборкой через MSR поддерживается только на Intel x86 в Linux");
+    }
+};
+#endif
+
+// Runs the pattern set on a working set served by one level; `name` prefixes the estimates and curves.
+static void detect_prefetch_level(const std::string &name, size_t bytes, size_t page_size, const Options &opts,
+                                  Report &report) {
+    auto run = [&](PrefetchPattern pattern, size_t stride, std::vector<double> *samples, PageBackend *got) {
+        return measure_prefetch(bytes, pattern, stride, page_size, opts.total_accesses, opts.trials,
+                                opts.pages_prefetch, samples, got);
+    };
+
+    std::vector<double> samples;
+    PageBackend got = opts.pages_prefetch;
+    const double random = run(PrefetchPattern::Random, 0, &samples, &got);
+
+    if (opts.verbose) {
+        std::cout << "\nPrefetcher probe (" << name << ", " << (bytes / 1024) << " KB, " << page_backend_name(got)
+                  << " pages):\n";
+        std::cout << "stride\tforward\tbackward\t" << timer_unit() << "/access\n";
+    }
+    const double page_shuffled = run(PrefetchPattern::PageShuffled, 0, nullptr, nullptr);
+
+    std::vector<SizePoint> forward, backward;
+    for (size_t stride: prefetch_strides) {
+        std::vector<double> fwd_samples, bwd_samples;
+        const double fwd = run(PrefetchPattern::Forward, stride, &fwd_samples, nullptr);
+        const double bwd = run(PrefetchPattern::Backward, stride, &bwd_samples, nullptr);
+        forward.push_back({stride, fwd, std::move(fwd_samples), got});
+        backward.push_back({stride, bwd, std::move(bwd_samples), got});
+
+        if (opts.verbose) std::cout << stride << "\t" << fwd << "\t" << bwd << "\n";
+    }
+    if (opts.verbose) {
+        std::cout << "random\t" << random << "\npage-shuffled\t" << page_shuffled << "\n";
+    }
+
+    // a stride counts as prefetched while it stays well below the random order; the range is contiguous from 64 B
+    const double covered_ratio = 0.6;
+    auto max_stride = [&](const std::vector<SizePoint> &pts) {
+        size_t best = 0;
+        for (const auto &p: pts) {
+            if (random <= 0.0 || p.per_access >= covered_ratio * random) break;
+            best = p.bytes;
+        }
+        return best;
+    };
+
+    const size_t fwd_max = max_stride(forward);
+    const size_t bwd_max = max_stride(backward);
+    const double sequential = forward.front().per_access;
+
+    report.estimates.emplace_back(name + "_bytes", double(bytes));
+    report.estimates.emplace_back(name + "_random", random);
+    report.estimates.emplace_back(name + "_sequential", sequential);
+    report.estimates.emplace_back(name + "_page_shuffled", page_shuffled);
+    report.estimates.emplace_back(name + "_detected", fwd_max != 0 || bwd_max != 0 ? 1.0 : 0.0);
+    report.estimates.emplace_back(name + "_max_stride_fwd", double(fwd_max));
+    report.estimates.emplace_back(name + "_max_stride_bwd", double(bwd_max));
+    // prefetching that stops at page boundaries makes contiguous pages no faster than shuffled ones
+    report.estimates.emplace_back(name + "_crosses_pages", sequential < 0.8 * page_shuffled ? 1.0 : 0.0);
+
+    const std::vector<std::pair<std::string, double>> params = {{"covered_ratio", covered_ratio},
+                                                                {"random", random}};
+    report.curves.push_back({name + "_fwd", "stride", std::move(forward), params, opts.pages_prefetch});
+    report.curves.push_back({name + "_bwd", "stride", std::move(backward), params, opts.pages_prefetch});
+}
+
+// Working sets served by L2 (shows the L1 prefetchers) and by the next level (shows the L2 ones).
+static std::vector<std::pair<std::string, size_t>> prefetch_working_sets(const Options &opts, const Report &report) {
+    const auto caches = cache_boundaries(report);
+
+    std::vector<std::pair<std::string, size_t>> sets;
+    for (size_t l = 1; l < caches.size() && sets.size() < 2; ++l) {
+        if (caches[l] / 2 > 2 * caches[l - 1]) sets.emplace_back("l" + std::to_string(l + 1), caches[l] / 2);
+    }
+    if (sets.size() < 2) sets.emplace_back("dram", hierarchy_max_bytes(opts));
+    return sets;
+}
+
+// The same working sets with the prefetchers of every probed CPU disabled. The MSRs are machine state, so a
+// per-CPU run does this once after its groups rather than in each of them.
+static void detect_prefetch_msr(size_t page_size, const Options &opts, Report &report) {
+#ifdef __linux__
+    const std::vector<int> cpus = opts.cpus.empty() ? allowed_cpus() : opts.cpus;
+#else
+    const std::vector<int> cpus;
+#endif
+    PrefetchMsrGuard guard(cpus, prefetch_msr_disable_all);
+    for (const auto &[level, bytes]: prefetch_working_sets(opts, report))
+        detect_prefetch_level("pf_off_" + level, bytes, page_size, opts, report);
+}
+
+static void detect_prefetch(size_t page_size, const Options &opts, Report &report) {
+    for (const auto &[level, bytes]: prefetch_working_sets(opts, report))
+        detect_prefetch_level("pf_" + level, bytes, page_size, opts, report);
+    if (opts.prefetch_msr) detect_prefetch_msr(page_size, opts, report);
+}
+
+
+// *------------------------------------------------------------------------------------*
+// |                              CORE-TO-CORE PROBE                                    |
+// *------------------------------------------------------------------------------------*
+enum class C2cFlavor {
+    Store,          // spin on loads, hand over with a plain release store
+    Rmw,            // spin on compare-exchange: every attempt takes the line exclusive
+};
+
+static const char *c2c_flavor_name(C2cFlavor flavor) {
+    return flavor == C2cFlavor::Store ? "store" : "rmw";
+}
+
+struct alignas(64) SharedLine {
+    std::atomic<uint64_t> value{0};
+};
+
+// One side of a ping-pong: waits until the line holds `turn`, writes turn + 1, then waits for turn + 2.
+// Started with turn 0 and 1 on two threads, every call of count rounds is count round trips of the line.
+struct PingPongKernel {
+    std::atomic<uint64_t> *line;
+    uint64_t turn;
+    C2cFlavor flavor;
+
+    uint64_t operator()(size_t count) {
+        for (size_t i = 0; i < count; ++i, turn += 2) {
+            if (flavor == C2cFlavor::Rmw) {
+                uint64_t expected = turn;
+                while (!line->compare_exchange_weak(expected, turn + 1, std::memory_order_acq_rel)) expected = turn;
+            } else {
+                while (line->load(std::memory_order_acquire) != turn) {}
+                line->store(turn + 1, std::memory_order_release);
+            }
+        }
+        return turn;
+    }
+};
+
+// Round-trip time of one cache line bounced between two pinned threads.
+static NOINLINE double measure_c2c(
+        int cpu_a,
+        int cpu_b,
+        C2cFlavor flavor,
+        size_t rounds,
+        int trials = 3,
+        std::vector<double> *samples = nullptr
+) {
+    const size_t warm_up = std::max<size_t>(rounds / 10, 100);
+    auto line = std::make_unique<SharedLine>();
+
+    std::vector<double> results;
+    results.reserve(trials);
+
+    for (int t = 0; more_trials(results, trials); ++t) {
+        line->value.store(0);
+        std::atomic<int> ready{0};
+        std::atomic<bool> failed{false};
+        std::exception_ptr errors[2];
+        double ns = 0.0;
+
+        // neither side may start spinning before both are pinned, or a failed pin would leave the other waiting
+        auto side = [&](int idx, int cpu) {
+            try {
+                pin_to_cpu(cpu);
+            } catch (...) {
+                errors[idx] = std::current_exception();
+                failed.store(true);
+            }
+            ready.fetch_add(1);
+            while (ready.load() < 2) {}
+            if (failed.load()) return;
+
+            PingPongKernel kernel{&line->value, uint64_t(idx), flavor};
+            if (idx == 0) ns = measure(warm_up, rounds, kernel);
+            else do_not_optimize(kernel(warm_up + rounds));
+        };
+
+        std::thread pong(side, 1, cpu_b);
+        std::thread ping(side, 0, cpu_a);
+        ping.join();
+        pong.join();
+        for (auto &error: errors)
+            if (error) std::rethrow_exception(error);
+
+        results.push_back(ns / double(rounds));
+    }
+
+    if (samples) *samples = results;
+    return median(results);
+}
+
+// Pair latencies split into tiers wherever the sorted values jump by more than `ratio`: SMT siblings,
+// cores sharing a cluster or L2, the rest of the die, other sockets.
+static std::vector<double> c2c_tiers(std::vector<double> values, double ratio = 1.3) {
+    std::sort(values.begin(), values.end());
+
+    std::vector<double> tiers, tier;
+    for (double v: values) {
+        if (!tier.empty() && v > tier.back() * ratio) {
+            tiers.push_back(median(tier));
+            tier.clear();
+        }
+        tier.push_back(v);
+    }
+    if (!tier.empty()) tiers.push_back(median(tier));
+    return tiers;
+}
+
+static void detect_c2c(const Options &opts, Report &report) {
+#ifdef __linux__
+    const std::vector<int> cpus = opts.cpus.empty() ? allowed_cpus() : opts.cpus;
+#else
+    const std::vector<int> cpus;
+#endif
+    report.estimates.emplace_back("c2c_cpus", double(cpus.size()));
+    for (size_t i = 0; i < cpus.size(); ++i) report.estimates.emplace_back("c2c_cpu" + std::to_string(i), cpus[i]);
+    if (cpus.size() < 2) return;
+
+    const size_t rounds = std::max<size_t>(opts.total_accesses / 64, 1000);
+
+    for (auto flavor: {C2cFlavor::Store, C2cFlavor::Rmw}) {
+        const std::string name = std::string("c2c_") + c2c_flavor_name(flavor);
+
+        if (opts.verbose) {
+            std::cout << "\nCore-to-core probe (" << c2c_flavor_name(flavor) << "):\n";
+            std::cout << "cpu\tcpu\t" << timer_unit() << "/round trip\n";
+        }
+
+        // the line travels the same way in both directions, so only one order of every pair is measured
+        std::vector<std::vector<SizePoint>> rows(cpus.size());
+        std::vector<double> pairs;
+        for (size_t a = 0; a < cpus.size(); ++a) {
+            for (size_t b = a + 1; b < cpus.size(); ++b) {
+                std::vector<double> samples;
+                const double ns = measure_c2c(cpus[a], cpus[b], flavor, rounds, opts.trials, &samples);
+                rows[a].push_back({size_t(cpus[b]), ns, samples});
+                rows[b].push_back({size_t(cpus[a]), ns, std::move(samples)});
+                pairs.push_back(ns);
+                report.estimates.emplace_back(name + "_" + std::to_string(cpus[a]) + "_" + std::to_string(cpus[b]), ns);
+
+                if (opts.verbose) std::cout << cpus[a] << "\t" << cpus[b] << "\t" << ns << "\n";
+            }
+        }
+
+        const auto tiers = c2c_tiers(pairs);
+        report.estimates.emplace_back(name + "_min", *std::min_element(pairs.begin(), pairs.end()));
+        report.estimates.emplace_back(name + "_max", *std::max_element(pairs.begin(), pairs.end()));
+        report.estimates.emplace_back(name + "_tiers", double(tiers.size()));
+        for (size_t k = 0; k < tiers.size(); ++k)
+            report.estimates.emplace_back(name + "_tier" + std::to_string(k + 1), tiers[k]);
+
+        for (size_t a = 0; a < cpus.size(); ++a) {
+            std::sort(rows[a].begin(), rows[a].end(), [](const SizePoint &x, const SizePoint &y) {
+                return x.bytes < y.bytes;
+            });
+            report.curves.push_back({name + "_cpu" + std::to_string(cpus[a]), "cpu", std::move(rows[a]), {}});
+        }
+    }
+}
+
+
+// *------------------------------------------------------------------------------------*
+// |                                   NUMA PROBE                                       |
+// *------------------------------------------------------------------------------------*
+// Latency (a single dependent chain, as in the MLP probe) and single-thread read bandwidth of a DRAM-sized buffer
+// for every pair of CPU node and memory node. Memory-only nodes get a column but no row.
+static void detect_numa(const Options &opts, Report &report) {
+    const auto nodes = numa_nodes();
+    const size_t bytes = hierarchy_max_bytes(opts);
+    const IsaInfo *isa = selected_isas(opts).front();
+
+    report.estimates.emplace_back("numa_nodes", double(nodes.size()));
+    report.estimates.emplace_back("numa_bytes", double(bytes));
+    for (size_t i = 0; i < nodes.size(); ++i) report.estimates.emplace_back("numa_node" + std::to_string(i), nodes[i]);
+
+    if (opts.verbose) {
+        std::cout << "\nNUMA probe (" << (bytes / 1024) << " KB):\n";
+        std::cout << "cpu node\tmem node\t" << timer_unit() << "/access\t" << bandwidth_unit() << "\n";
+    }
+
+    for (int cpu_node: nodes) {
+        const auto cpus = node_cpus(cpu_node);
+        if (cpus.empty()) continue;
+
+        for (int mem_node: nodes) {
+            std::vector<double> lat_samples, bw_samples;
+            double latency = 0.0, bandwidth = 0.0;
+            std::exception_ptr error;
+
+            // a fresh thread, so the caller keeps its own affinity
+            std::thread worker([&] {
+                try {
+                    pin_to_cpus(cpus);
+                    g_mem_node = mem_node;
+                    latency = measure_mlp(bytes, 0, opts.total_accesses, opts.trials, PageBackend::Default,
+                                          &lat_samples);
+                    bandwidth = measure_bandwidth(*isa, BandwidthKernel::Read, bytes, opts.total_accesses,
+                                                  opts.trials, &bw_samples);
+                } catch (...) {
+                    error = std::current_exception();
+                }
+            });
+            worker.join();
+            if (error) std::rethrow_exception(error);
+
+            const std::string cell = std::to_string(cpu_node) + "_" + std::to_string(mem_node);
+            report.estimates.emplace_back("numa_lat_" + cell, latency);
+            report.estimates.emplace_back("numa_bw_" + cell, bandwidth);
+            report.curves.push_back({"numa_lat_" + cell, "bytes", {{bytes, latency, std::move(lat_samples)}}, {}});
+            report.curves.push_back({"numa_bw_" + cell, "bytes", {{bytes, bandwidth, std::move(bw_samples)}}, {}});
+
+            if (opts.verbose) {
+                std::cout << cpu_node << "\t\t" << mem_node << "\t\t" << latency << "\t\t" << bandwidth << "\n";
+            }
+        }
+    }
+}
+
+
+// *------------------------------------------------------------------------------------*
+// |                               REPORTED GEOMETRY                                    |
+// *------------------------------------------------------------------------------------*
+// l1d, l1i, l2, l3, ...
+static std::string reported_name(const ReportedCache &cache) {
+    std::string name = "l" + std::to_string(cache.level);
+    if (cache.type == "Data") name += "d";
+    if (cache.type == "Instruction") name += "i";
+    return name;
+}
+
+// Instant path: reported_<cache>_bytes/_ways/_line_bytes/_sets estimates and the source in the "reported" note.
+static void add_reported_estimates(Report &report, int cpu) {
+    std::string source;
+    const auto caches = reported_caches(cpu, &source);
+    if (caches.empty()) {
+        report.notes.emplace_back("reported", "neither sysfs nor CPUID describe the caches");
+        return;
+    }
+
+    report.notes.emplace_back("reported", source);
+    for (const auto &cache: caches) {
+        const std::string name = "reported_" + reported_name(cache);
+        report.estimates.emplace_back(name + "_bytes", double(cache.bytes));
+        report.estimates.emplace_back(name + "_ways", double(cache.ways));
+        report.estimates.emplace_back(name + "_line_bytes", double(cache.line));
+        report.estimates.emplace_back(name + "_sets", double(cache.sets));
+    }
+}
+
+// Reported values the probes measure, paired with the measured estimate.
+static const std::pair<const char *, const char *> cross_checked[] = {
+        {"l1d_bytes",      "l1_bytes"},
+        {"l1d_ways",       "l1_ways"},
+        {"l1d_line_bytes", "l1_line_bytes"},
+        {"l2_bytes",       "hierarchy_l2_bytes"},
+        {"l3_bytes",       "hierarchy_l3_bytes"},
+};
+
+static double measured_value(const Report &report, const std::string &name) {
+    if (name.rfind("hierarchy_l", 0) == 0) {
+        const size_t i = size_t(name[11] - '1');
+        return i < report.levels.size() ? double(report.levels[i].bytes) : 0.0;
+    }
+    return estimate(report, name);
+}
+
+// Compares the measured geometry with the reported one (of the CPU the probes ran on). A value agrees if it is
+// within 25% of the reported one, which still tells 48 from 32 KB or 64 from 128 B lines but forgives the ways
+// probe's step of 2. check_<name> is 1 or 0 for every value both sides have.
+static void cross_check(Report &report) {
+    add_reported_estimates(report, current_cpu());
+
+    size_t mismatches = 0;
+    for (const auto &c: cross_checked) {
+        const double reported = estimate(report, std::string("reported_") + c.first);
+        const double measured = measured_value(report, c.second);
+        if (reported <= 0.0 || measured <= 0.0) continue;
+
+        const bool agrees = std::max(reported, measured) / std::min(reported, measured) <= 1.25;
+        report.estimates.emplace_back(std::string("check_") + c.first, agrees ? 1.0 : 0.0);
+        if (!agrees) ++mismatches;
+    }
+    report.estimates.emplace_back("check_mismatches", double(mismatches));
+}
+
+// *------------------------------------------------------------------------------------*
+// |                                  PROBE DRIVER                                      |
+// *------------------------------------------------------------------------------------*
+static void print_size_estimate(std::ostream &out, const Report &report) {
+    if (!report.levels.empty() || !note(report, "hierarchy").empty()) {
+        out << "\nEstimated memory hierarchy:\n";
+        for (size_t i = 0; i < report.levels.size(); ++i) {
+            const auto &level = report.levels[i];
+            if (level.bytes == 0) {
+                out << "  DRAM: " << level.per_access << " " << timer_unit() << "/access\n";
+            } else {
+                out << "  L" << (i + 1) << ": ~" << (level.bytes / 1024) << " KB";
+                if (level.bytes_hi > level.bytes_lo)
+                    out << " (" << level.bytes_lo / 1024 << ".." << level.bytes_hi / 1024 << " KB)";
+                out << ", " << level.per_access << " " << timer_unit() << "/access\n";
+            }
+        }
+        if (report.levels.size() <= 1) out << "  no cache level detected: " << note(report, "hierarchy") << "\n";
+        return;
+    }
+
+    const auto l1_bytes = size_t(estimate(report, "l1_bytes"));
+    if (l1_bytes == 0) {
+        out << "\nL1 size not detected in 2KB..1MB: " << note(report, "l1_bytes") << "\n";
+    } else {
+        out << "\nEstimated L1 D-cache size: ~" << (l1_bytes / 1024) << " KB";
+        if (estimate(report, "l1_bytes_hi") > estimate(report, "l1_bytes_lo")) {
+            out << " (" << size_t(estimate(report, "l1_bytes_lo")) / 1024 << ".."
+                << size_t(estimate(report, "l1_bytes_hi")) / 1024 << " KB)";
+        }
+        out << "\n";
+    }
+}
+
+static void print_ways_estimate(std::ostream &out, const Report &report) {
+    const auto ways = size_t(estimate(report, "l1_ways"));
+    if (ways == 0) {
+        out << "\nL1 associativity not detected: " << note(report, "l1_ways") << "\n";
+    } else {
+        out << "\nEstimated L1 D-cache associativity: ~" << ways << "-way";
+        if (estimate(report, "l1_ways_hi") > estimate(report, "l1_ways_lo"))
+            out << " (" << estimate(report, "l1_ways_lo") << ".." << estimate(report, "l1_ways_hi") << ")";
+        out << "\n";
+    }
+}
+
+static void print_line_estimate(std::ostream &out, const Report &report) {
+    const auto line_bytes = size_t(estimate(report, "l1_line_bytes"));
+    if (line_bytes == 0) {
+        out << "\nL1 cache line size not detected: " << note(report, "l1_line_bytes") << "\n";
+    } else {
+        out << "\nEstimated L1 D-cache line size: ~" << line_bytes << " B\n";
+    }
+}
+
+static void print_tlb_estimate(std::ostream &out, const Report &report) {
+    for (const char *kind: {"base", "huge"}) {
+        const std::string prefix = std::string("tlb_") + kind;
+        if (!has_estimate(report, prefix + "_page_bytes")) continue;
+
+        const auto page_bytes = size_t(estimate(report, prefix + "_page_bytes"));
+        if (page_bytes == 0) {
+            out << "\nTLB (" << kind << " pages): huge pages are not available.\n";
+            continue;
+        }
+
+        const auto levels = size_t(estimate(report, prefix + "_levels"));
+        if (levels == 0) {
+            out << "\nTLB (" << (page_bytes / 1024) << " KB pages) not detected: " << note(report, prefix) << "\n";
+            continue;
+        }
+
+        out << "\nEstimated TLB (" << (page_bytes / 1024) << " KB pages):\n";
+        for (size_t l = 1; l <= levels; ++l) {
+            const std::string level = prefix + "_l" + std::to_string(l);
+            const auto entries = size_t(estimate(report, level + "_entries"));
+            const char *name = l == 1 ? "L1 DTLB" : l == 2 ? "STLB" : "TLB";
+            out << "  " << name << ": ~" << entries << " entries ("
+                << size_t(estimate(report, level + "_entries_lo")) << ".."
+                << size_t(estimate(report, level + "_entries_hi")) << ", " << (entries * page_bytes / 1024)
+                << " KB reach), "
+                << (l == levels && l > 1 ? "page walk" : "miss") << " +" << estimate(report, level + "_penalty")
+                << " " << timer_unit() << "/access\n";
+        }
+    }
+}
+
+static void print_bandwidth_estimate(std::ostream &out, const Report &report) {
+    if (!has_estimate(report, "bw_threads")) return;
+
+    const BandwidthKernel kernels[] = {BandwidthKernel::Read, BandwidthKernel::Write, BandwidthKernel::Copy,
+                                       BandwidthKernel::NtWrite};
+
+    for (const auto &isa: isa_table) {
+        const std::string prefix = std::string("bw_") + isa.name + "_";
+        if (!has_estimate(report, prefix + "bits")) continue;
+
+        for (const char *threads: {"_1t", "_all"}) {
+            const size_t count = threads == std::string("_1t") ? 1 : size_t(estimate(report, "bw_threads"));
+            out << "\nEstimated bandwidth, " << isa.name << " (" << isa.bits << "-bit), " << bandwidth_unit() << " ("
+                << count << (count == 1 ? " thread" : " threads") << "):\nLevel";
+            for (auto kernel: kernels) out << "\t" << bandwidth_kernel_name(kernel);
+            out << "\n";
+
+            for (size_t l = 1;; ++l) {
+                std::string level = "l" + std::to_string(l);
+                if (!has_estimate(report, prefix + "read" + threads + "_" + level)) level = "dram";
+
+                out << (level == "dram" ? std::string("DRAM") : "L" + std::to_string(l));
+                for (auto kernel: kernels)
+                    out << "\t" << estimate(report, prefix + bandwidth_kernel_name(kernel) + threads + "_" + level);
+                out << "\n";
+                if (level == "dram") break;
+            }
+        }
+    }
+}
+
+static void print_mlp_estimate(std::ostream &out, const Report &report) {
+    if (!has_estimate(report, "mlp_dram_bytes")) return;
+
+    std::vector<std::pair<std::string, std::string>> levels;
+    for (size_t l = 2; has_estimate(report, "mlp_l" + std::to_string(l) + "_bytes"); ++l)
+        levels.emplace_back("L" + std::to_string(l), "mlp_l" + std::to_string(l));
+    levels.emplace_back("DRAM", "mlp_dram");
+
+    out << "\nEstimated memory-level parallelism:\n";
+    for (const auto &[level, name]: levels) {
+        out << "  " << level << " (" << size_t(estimate(report, name + "_bytes")) / 1024 << " KB): ~"
+            << size_t(estimate(report, name + "_chains")) << " misses in flight, x" << estimate(report, name + "_speedup")
+            << " over " << estimate(report, name + "_latency") << " " << timer_unit() << "/access\n";
+    }
+}
+
+static void print_prefetch_estimate(std::ostream &out, const Report &report) {
+    for (const char *state: {"pf_", "pf_off_"}) {
+        std::vector<std::pair<std::string, std::string>> levels;
+        for (size_t l = 2; has_estimate(report, state + ("l" + std::to_string(l)) + "_bytes"); ++l)
+            levels.emplace_back("L" + std::to_string(l), state + ("l" + std::to_string(l)));
+        if (has_estimate(report, state + std::string("dram_bytes"))) levels.emplace_back("DRAM", state + std::string("dram"));
+        if (levels.empty()) continue;
+
+        out << "\nHardware prefetchers" << (state == std::string("pf_") ? "" : " (disabled via MSR)") << ":\n";
+        for (const auto &[level, name]: levels) {
+            out << "  " << level << " (" << size_t(estimate(report, name + "_bytes")) / 1024 << " KB): ";
+            if (estimate(report, name + "_detected") == 0.0) {
+                out << "no prefetching detected";
+            } else {
+                out << "strides up to +" << size_t(estimate(report, name + "_max_stride_fwd")) << "/-"
+                    << size_t(estimate(report, name + "_max_stride_bwd")) << " B, "
+                    << (estimate(report, name + "_crosses_pages") != 0.0 ? "crosses" : "stops at") << " page boundaries";
+            }
+            out << "; sequential " << estimate(report, name + "_sequential") << ", random "
+                << estimate(report, name + "_random") << " " << timer_unit() << "/access\n";
+        }
+    }
+}
+
+static void print_c2c_estimate(std::ostream &out, const Report &report) {
+    if (!has_estimate(report, "c2c_cpus")) return;
+
+    std::vector<std::string> cpus;
+    for (size_t i = 0; i < size_t(estimate(report, "c2c_cpus")); ++i)
+        cpus.push_back(std::to_string(int(estimate(report, "c2c_cpu" + std::to_string(i)))));
+    if (cpus.size() < 2) {
+        out << "\nCore-to-core latency needs at least 2 CPUs.\n";
+        return;
+    }
+
+    for (auto flavor: {C2cFlavor::Store, C2cFlavor::Rmw}) {
+        const std::string name = std::string("c2c_") + c2c_flavor_name(flavor);
+
+        out << "\nCore-to-core round trip (" << c2c_flavor_name(flavor) << "), " << timer_unit() << ":\nCPU";
+        for (const auto &cpu: cpus) out << "\t" << cpu;
+        out << "\n";
+
+        for (size_t a = 0; a < cpus.size(); ++a) {
+            out << cpus[a];
+            for (size_t b = 0; b < cpus.size(); ++b) {
+                out << "\t";
+                if (a == b) out << "-";
+                else out << estimate(report, name + "_" + cpus[std::min(a, b)] + "_" + cpus[std::max(a, b)]);
+            }
+            out << "\n";
+        }
+
+        const auto tiers = size_t(estimate(report, name + "_tiers"));
+        out << "  tiers:";
+        for (size_t k = 1; k <= tiers; ++k) out << " " << estimate(report, name + "_tier" + std::to_string(k));
+        out << "\n";
+    }
+}
+
+static void print_numa_estimate(std::ostream &out, const Report &report) {
+    if (!has_estimate(report, "numa_nodes")) return;
+
+    std::vector<std::string> nodes;
+    for (size_t i = 0; i < size_t(estimate(report, "numa_nodes")); ++i)
+        nodes.push_back(std::to_string(int(estimate(report, "numa_node" + std::to_string(i)))));
+
+    for (const char *kind: {"lat", "bw"}) {
+        const bool lat = kind == std::string("lat");
+        out << "\nNUMA " << (lat ? "latency, " + std::string(timer_unit()) + "/access" : "read bandwidth, " +
+                                                                                         std::string(bandwidth_unit()))
+            << " (" << size_t(estimate(report, "numa_bytes")) / 1024 << " KB, rows: CPU node, columns: memory node):\n"
+            << "Node";
+        for (const auto &node: nodes) out << "\t" << node;
+        out << "\n";
+
+        for (const auto &cpu_node: nodes) {
+            const std::string row = std::string("numa_") + kind + "_" + cpu_node + "_";
+            if (!has_estimate(report, row + nodes.front())) continue;
+
+            out << cpu_node;
+            for (const auto &mem_node: nodes) out << "\t" << estimate(report, row + mem_node);
+            out << "\n";
+        }
+    }
+}
+
+// Precision the sampling actually reached over all measured points: the relative width of each point's interval.
+static void add_precision_estimates(const Options &opts, Report &report) {
+    std::vector<double> widths;
+    size_t capped = 0;
+    for (const auto &curve: report.curves) {
+        for (const auto &p: curve.points) {
+            if (p.samples.size() < 2) continue;
+            const double width = relative_width(p.samples);
+            widths.push_back(width);
+            if (opts.precision > 0.0 && width > opts.precision) ++capped;
+        }
+    }
+    if (widths.empty()) return;
+
+    report.estimates.emplace_back("precision_points", double(widths.size()));
+    report.estimates.emplace_back("precision_worst", *std::max_element(widths.begin(), widths.end()));
+    report.estimates.emplace_back("precision_median", median(widths));
+    report.estimates.emplace_back("precision_capped", double(capped));
+}
+
+static void print_precision_estimate(std::ostream &out, const Report &report) {
+    if (!has_estimate(report, "precision_points")) return;
+
+    out << "\nPrecision (95% interval of the median): " << estimate(report, "precision_median") * 100.0
+        << "% typical, " << estimate(report, "precision_worst") * 100.0 << "% worst over "
+        << size_t(estimate(report, "precision_points")) << " points";
+    if (estimate(report, "precision_capped") > 0)
+        out << "; " << size_t(estimate(report, "precision_capped")) << " stopped at the trial limit";
+    out << "\n";
+}
+
+static void print_budget_estimate(std::ostream &out, const Report &report) {
+    if (!has_estimate(report, "budget_ms")) return;
+
+    out << "\nBudget: " << estimate(report, "budget_used_ms") << " of " << estimate(report, "budget_ms") << " ms";
+    if (estimate(report, "budget_skipped") > 0)
+        out << ", " << size_t(estimate(report, "budget_skipped")) << " points skipped";
+    out << (estimate(report, "confident") > 0 ? "; estimates complete\n"
+                                              : "; estimates are a best guess, rerun with a larger budget\n");
+}
+
+static void print_sets_estimate(std::ostream &out, const Report &report) {
+    const bool l1 = has_estimate(report, "sets_l1_ways");
+    if (!l1 && note(report, "sets_l1").empty()) return;
+
+    out << "\nCache sets:\n";
+    if (l1) {
+        const auto way_bytes = size_t(estimate(report, "sets_l1_way_bytes"));
+        out << "  L1: " << estimate(report, "sets_l1_sets") << " sets x " << estimate(report, "sets_l1_ways")
+            << " ways, " << way_bytes << " B per way, index bits " << estimate(report, "sets_l1_index_lo") << ".."
+            << estimate(report, "sets_l1_index_hi")
+            << (estimate(report, "sets_l1_vipt") > 0 ? " (within the page offset: VIPT without aliasing)\n"
+                                                     : " (above the page offset: PIPT or VIPT with alias handling)\n");
+    } else {
+        out << "  L1 not detected: " << note(report, "sets_l1") << "\n";
+    }
+    if (!note(report, "sets_l1_line").empty()) out << "  " << note(report, "sets_l1_line") << "; reported size used\n";
+
+    for (int level = 2; level <= 4; ++level) {
+        const std::string name = "sets_l" + std::to_string(level);
+        if (!note(report, name).empty()) out << "  L" << level << " not tested: " << note(report, name) << "\n";
+        if (!has_estimate(report, name + "_hashed")) continue;
+
+        out << "  L" << level << ": "
+            << (estimate(report, name + "_hashed") > 0 ? "likely hashed index" : "likely linear index")
+            << " (" << estimate(report, name + "_lines") << " lines " << size_t(estimate(report, name + "_stride"))
+            << " B apart: " << estimate(report, name + "_conflict") << " vs hit " << estimate(report, name + "_hit")
+            << ", next level " << estimate(report, name + "_next") << " " << timer_unit() << "/access)";
+        if (estimate(report, name + "_sets_pow2") == 0) out << "; reported set count is not a power of two";
+        out << "\n";
+    }
+}
+
+static void print_eviction_estimate(std::ostream &out, const Report &report) {
+    bool header = false;
+    for (int level = 2; level <= 4; ++level) {
+        const std::string name = "evict_l" + std::to_string(level);
+        const bool found = has_estimate(report, name + "_ways");
+        if (!found && note(report, name).empty()) continue;
+        if (!header) out << "\nEviction sets:\n";
+        header = true;
+
+        if (!found) {
+            out << "  L" << level << " not built: " << note(report, name) << "\n";
+            continue;
+        }
+        out << "  L" << level << ": minimal set of " << estimate(report, name + "_ways") << " lines (reported "
+            << estimate(report, name + "_reported_ways") << " ways; per target";
+        for (int t = 0; t < evict_targets; ++t)
+            out << " " << (has_estimate(report, name + "_ways_" + std::to_string(t))
+                           ? std::to_string(size_t(estimate(report, name + "_ways_" + std::to_string(t)))) : "-");
+        out << ")";
+        if (has_estimate(report, name + "_cat_ways"))
+            out << ", CAT allows " << estimate(report, name + "_cat_ways") << " ways (" << note(report, name + "_cat")
+                << ")";
+        out << "\n";
+    }
+}
+
+static void print_policy_estimate(std::ostream &out, const Report &report) {
+    bool header = false;
+    for (int level = 1; level <= 4; ++level) {
+        const std::string name = "policy_l" + std::to_string(level);
+        const std::string model = note(report, name + "_model");
+        if (model.empty() && note(report, name).empty()) continue;
+        if (!header) out << "\nReplacement policy:\n";
+        header = true;
+
+        if (model.empty()) {
+            out << "  L" << level << " not identified: " << note(report, name) << "\n";
+            continue;
+        }
+        out << "  L" << level << ": " << model << ", " << 100 * estimate(report, name + "_agreement")
+            << "% agreement (" << estimate(report, name + "_ways") << " ways; others";
+        for (Policy policy: policies) {
+            const std::string other = name + "_agreement_" + policy_name(policy);
+            if (policy_name(policy) != model && has_estimate(report, other))
+                out << " " << policy_name(policy) << " " << 100 * estimate(report, other) << "%";
+        }
+        out << ")\n";
+    }
+}
+
+static void print_reported_estimate(std::ostream &out, const Report &report) {
+    const std::string source = note(report, "reported");
+    if (source.empty()) return;
+    if (!has_estimate(report, "reported_l1d_bytes") && !has_estimate(report, "reported_l2_bytes")) {
+        out << "\nReported caches: " << source << "\n";
+        return;
+    }
+
+    out << "\nReported caches (" << source << "):\n";
+    for (const std::string name: {"l1d", "l1i", "l2", "l3", "l4"}) {
+        const std::string prefix = "reported_" + name;
+        if (!has_estimate(report, prefix + "_bytes")) continue;
+        out << "  " << char(std::toupper(name[0])) << name.substr(1) << ": "
+            << size_t(estimate(report, prefix + "_bytes")) / 1024 << " KB, "
+            << estimate(report, prefix + "_ways") << "-way, " << estimate(report, prefix + "_line_bytes") << " B line, "
+            << estimate(report, prefix + "_sets") << " sets\n";
+    }
+}
+
+static void print_cross_check(std::ostream &out, const Report &report) {
+    if (!has_estimate(report, "check_mismatches")) return;
+
+    out << "\nCross-check against " << note(report, "reported") << ":\n";
+    for (const auto &c: cross_checked) {
+        const std::string name = std::string("check_") + c.first;
+        if (!has_estimate(report, name)) continue;
+        out << "  " << c.first << ": reported " << size_t(estimate(report, std::string("reported_") + c.first))
+            << ", measured " << size_t(measured_value(report, c.second))
+            << (estimate(report, name) > 0 ? ", agrees\n" : ", DISAGREES\n");
+    }
+    if (estimate(report, "check_mismatches") > 0)
+        out << "  reported and measured geometry disagree: the topology is virtualized or the run was disturbed\n";
+}
+
+static void print_estimates(std::ostream &out, const Report &report) {
+    print_size_estimate(out, report);
+    print_ways_estimate(out, report);
+    print_line_estimate(out, report);
+    print_tlb_estimate(out, report);
+    print_bandwidth_estimate(out, report);
+    print_mlp_estimate(out, report);
+    print_prefetch_estimate(out, report);
+    print_c2c_estimate(out, report);
+    print_numa_estimate(out, report);
+    print_sets_estimate(out, report);
+    print_eviction_estimate(out, report);
+    print_policy_estimate(out, report);
+    print_cross_check(out, report);
+    print_precision_estimate(out, report);
+    print_budget_estimate(out, report);
+}
+
+// Starts the --budget clock for the calling thread and scales the accesses per point down to fit it.
+static void start_budget(Options &opts) {
+    if (opts.budget_ms <= 0.0) return;
+
+    const auto start = std::chrono::steady_clock::now();
+    g_budget = {true, start, start + std::chrono::microseconds(long(opts.budget_ms * 1000.0)), start, 0};
+    // ~50 accesses per ms of budget: a trial at DRAM latency then costs about 1% of it
+    opts.total_accesses = std::min<size_t>(opts.total_accesses, std::max<size_t>(size_t(opts.budget_ms * 50.0), 10000));
+}
+
+// Runs the three L1 probes (or the hierarchy sweep instead of the size probe) and the optional ones;
+// prose goes to `out` if given. With --budget the three core probes share the wall-clock budget (one phase each)
+// and run with fewer accesses per point; the optional probes after them are not budgeted.
+static Report run_probes(size_t page_size, const Options &all_opts, std::ostream *out) {
+    Report report;
+
+    Options opts = all_opts;
+    start_budget(opts);
+
+    // 1) L1 size (or the whole hierarchy); the stride probe and the hierarchy sweep walk DRAM, so each of them
+    // gets about half of what is left
+    budget_phase(opts.hierarchy ? 2 : 4);
+    size_t l1_bytes = 0;
+    if (opts.hierarchy) {
+        report.levels = detect_hierarchy(opts, &report);
+        if (!report.levels.empty()) l1_bytes = report.levels.front().bytes;
+    } else {
+        l1_bytes = detect_size_L1(opts, &report);
+    }
+    report.estimates.emplace_back("l1_bytes", double(l1_bytes));
+    if (out) print_size_estimate(*out, report);
+
+    // 2) associativity (ways)
+    budget_phase(3);
+    size_t ways = detect_associativity_L1(page_size, opts, &report);
+    report.estimates.emplace_back("l1_ways", double(ways));
+    if (out) print_ways_estimate(*out, report);
+
+    // 3) cache line size
+    budget_phase(1);
+    size_t line_bytes = detect_stride_size_L1(page_size, opts, &report);
+    report.estimates.emplace_back("l1_line_bytes", double(line_bytes));
+    if (out) print_line_estimate(*out, report);
+
+    if (g_budget.active) {
+        const std::chrono::duration<double, std::milli> used = std::chrono::steady_clock::now() - g_budget.start;
+        const bool confident = g_budget.skipped == 0 && l1_bytes != 0 && ways != 0 && line_bytes != 0;
+        report.estimates.emplace_back("budget_ms", opts.budget_ms);
+        report.estimates.emplace_back("budget_used_ms", used.count());
+        report.estimates.emplace_back("budget_skipped", double(g_budget.skipped));
+        report.estimates.emplace_back("confident", confident ? 1.0 : 0.0);
+        g_budget.active = false;
+        opts = all_opts;
+    }
+
+    // 4) TLB reach and page-walk penalty
+    if (opts.tlb) {
+        detect_tlbs(page_size, opts, report);
+        if (out) print_tlb_estimate(*out, report);
+    }
+
+    // 5) streaming bandwidth per level
+    if (opts.bandwidth) {
+        detect_bandwidth(opts, report);
+        if (out) print_bandwidth_estimate(*out, report);
+    }
+
+    // 6) outstanding misses per level
+    if (opts.mlp) {
+        detect_mlp(opts, report);
+        if (out) print_mlp_estimate(*out, report);
+    }
+
+    // 7) hardware prefetchers
+    if (opts.prefetch) {
+        detect_prefetch(page_size, opts, report);
+        if (out) print_prefetch_estimate(*out, report);
+    }
+
+    // 8) cache line transfer between CPU pairs
+    if (opts.c2c) {
+        detect_c2c(opts, report);
+        if (out) print_c2c_estimate(*out, report);
+    }
+
+    // 9) local vs remote memory
+    if (opts.numa) {
+        detect_numa(opts, report);
+        if (out) print_numa_estimate(*out, report);
+    }
+
+    // 10) number of sets and the index function
+    if (opts.sets) {
+        detect_sets(page_size, opts, report);
+        if (out) print_sets_estimate(*out, report);
+    }
+
+    // 11) minimal eviction sets of L2/L3
+    if (opts.evict) {
+        detect_eviction(page_size, opts, report);
+        if (out) print_eviction_estimate(*out, report);
+    }
+
+    // 12) replacement policy per level
+    if (opts.policy) {
+        detect_policy(page_size, opts, report);
+        if (out) print_policy_estimate(*out, report);
+    }
+
+    // 13) measured vs reported geometry
+    if (opts.cross_check) {
+        cross_check(report);
+        if (out) print_cross_check(*out, report);
+    }
+
+    add_precision_estimates(opts, report);
+    if (out) print_precision_estimate(*out, report);
+    if (out) print_budget_estimate(*out, report);
+
+    return report;
+}
+
+
+// *------------------------------------------------------------------------------------*
+// |                                 PER-CPU SWEEP                                      |
+// *------------------------------------------------------------------------------------*
+struct CpuResult {
+    int cpu;
+    Report report;
+};
+
+// CPUs sharing an L1 or L2 (SMT siblings, E-core clusters) would disturb each other, so they end up
+// in the same group and are probed one after another; distinct groups run concurrently.
+// CPUs sharing a cache of level <= max_level (or a core) end up in one group
+static std::vector<std::vector<int>> group_by_shared_cache(const std::vector<int> &cpus, int max_level) {
+    std::map<int, int> parent;
+    for (int cpu: cpus) parent[cpu] = cpu;
+
+    auto find = [&](int cpu) {
+        while (parent[cpu] != cpu) cpu = parent[cpu] = parent[parent[cpu]];
+        return cpu;
+    };
+
+    for (int cpu: cpus) {
+        const std::string dir = "/sys/devices/system/cpu/cpu" + std::to_string(cpu);
+
+        std::vector<int> shared = parse_cpu_list(read_sysfs(dir + "/topology/thread_siblings_list"));
+        for (const auto &cache: sysfs_caches(cpu)) {
+            if (cache.level > max_level || cache.type == "Instruction") continue;
+            shared.insert(shared.end(), cache.shared_cpus.begin(), cache.shared_cpus.end());
+        }
+
+        for (int other: shared)
+            if (parent.count(other)) parent[find(other)] = find(cpu);
+    }
+
+    std::map<int, std::vector<int>> groups;
+    for (int cpu: cpus) groups[find(cpu)].push_back(cpu);
+
+    std::vector<std::vector<int>> result;
+    for (auto &group: groups) result.push_back(std::move(group.second));
+    return result;
+}
+
+static CpuResult probe_cpu(int cpu, size_t page_size, const Options &opts) {
+    pin_to_cpu(cpu);
+    return CpuResult{cpu, run_probes(page_size, opts, nullptr)};
+}
+
+static std::vector<CpuResult> run_per_cpu(size_t page_size, const Options &opts) {
+    const std::vector<int> cpus = opts.cpus.empty() ? allowed_cpus() : opts.cpus;
+
+    // curves from concurrent workers would interleave; machine-wide probes (threads on every CPU, shared MSRs) are
+    // left out here and run once by the caller, after the groups
+    Options worker_opts = opts;
+    worker_opts.verbose = false;
+    worker_opts.bandwidth = false;
+    worker_opts.c2c = false;
+    worker_opts.numa = false;
+    worker_opts.prefetch_msr = false;
+
+    // the hierarchy sweep walks rings up to DRAM size: with groups sharing an LLC running side by side its L3 and
+    // DRAM plateaus would measure contention, so then CPUs of one LLC domain are probed one after another
+    const int shared_level = opts.hierarchy ? std::numeric_limits<int>::max() : 2;
+    const auto groups = group_by_shared_cache(cpus, shared_level);
+    std::vector<std::exception_ptr> errors(groups.size());
+    std::vector<std::thread> workers;
+    workers.reserve(groups.size());
+
+    if (opts.verbose) {
+        std::cout << "\nProbing " << cpus.size() << " CPUs in " << groups.size() << " concurrent groups\n";
+    }
+
+    std::vector<std::vector<CpuResult>> results(groups.size());
+    const int mem_node = g_mem_node;
+    for (size_t g = 0; g < groups.size(); ++g) {
+        workers.emplace_back([&, g] {
+            g_mem_node = mem_node;
+            try {
+                for (int cpu: groups[g]) results[g].push_back(probe_cpu(cpu, page_size, worker_opts));
+            } catch (...) {
+                errors[g] = std::current_exception();
+            }
+        });
+    }
+
+    for (auto &worker: workers) worker.join();
+    for (auto &error: errors)
+        if (error) std::rethrow_exception(error);
+
+    std::vector<CpuResult> out;
+    for (auto &group: results) out.insert(out.end(), group.begin(), group.end());
+    std::sort(out.begin(), out.end(), [](const CpuResult &a, const CpuResult &b) { return a.cpu < b.cpu; });
+    return out;
+}
+
+static void print_per_cpu_table(const std::vector<CpuResult> &results, bool hierarchy) {
+    std::cout << "\nCPU\tL1(KB)\tWays\tLine(B)";
+    if (hierarchy) std::cout << "\tHierarchy";
+    std::cout << "\n";
+
+    for (const auto &r: results) {
+        std::cout << r.cpu << "\t" << size_t(estimate(r.report, "l1_bytes")) / 1024
+                  << "\t" << estimate(r.report, "l1_ways")
+                  << "\t" << estimate(r.report, "l1_line_bytes");
+        if (hierarchy) {
+            const auto &levels = r.report.levels;
+            std::cout << "\t";
+            for (size_t i = 0; i < levels.size(); ++i) {
+                if (i != 0) std::cout << " / ";
+                if (levels[i].bytes == 0) std::cout << "DRAM " << levels[i].per_access << timer_unit();
+                else std::cout << (levels[i].bytes / 1024) << "K " << levels[i].per_access << timer_unit();
+            }
+        }
+        std::cout << "\n";
+    }
+}
+
+
+// *------------------------------------------------------------------------------------*
+// |                               STRUCTURED OUTPUT                                    |
+// *------------------------------------------------------------------------------------*
+static const char *timer_name() {
+    switch (g_timer.backend) {
+        case TimerBackend::Tsc:
+            return "tsc";
+        case TimerBackend::Perf:
+            return "perf";
+        default:
+            return "chrono";
+    }
+}
+
+static std::string json_string(const std::string &str) {
+    std::string out = "\"";
+    for (char c: str) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (c == '\n') {
+            out += "\\n";
+        } else if (c == '\t') {
+            out += "\\t";
+        } else if (c == '\r') {
+            out += "\\r";
+        } else if ((unsigned char) c < 0x20) {
+            char escaped[8];
+            std::snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned) (unsigned char) c);
+            out += escaped;
+        } else {
+            out += c;
+        }
+    }
+    return out + "\"";
+}
+
+static std::string json_number(double v) {
+    if (!std::isfinite(v)) return "null";
+    std::ostringstream out;
+    out.precision(10);
+    out << v;
+    return out.str();
+}
+
+static void write_json_report(std::ostream &out, const Report &report, const std::string &indent) {
+    out << indent << "\"estimates\": {";
+    for (size_t i = 0; i < report.estimates.size(); ++i) {
+        out << (i ? ", " : "") << json_string(report.estimates[i].first) << ": "
+            << json_number(report.estimates[i].second);
+    }
+    out << "},\n";
+
+    out << indent << "\"levels\": [";
+    for (size_t i = 0; i < report.levels.size(); ++i) {
+        out << (i ? ", " : "") << "{\"bytes\": " << report.levels[i].bytes
+            << ", \"bytes_lo\": " << report.levels[i].bytes_lo << ", \"bytes_hi\": " << report.levels[i].bytes_hi
+            << ", \"per_access\": " << json_number(report.levels[i].per_access) << "}";
+    }
+    out << "],\n";
+
+    out << indent << "\"notes\": {";
+    for (size_t i = 0; i < report.notes.size(); ++i)
+        out << (i ? ", " : "") << json_string(report.notes[i].first) << ": " << json_string(report.notes[i].second);
+    out << "},\n";
+
+    out << indent << "\"curves\": [";
+    for (size_t c = 0; c < report.curves.size(); ++c) {
+        const auto &curve = report.curves[c];
+        out << (c ? "," : "") << "\n" << indent << "  {\"probe\": " << json_string(curve.probe)
+            << ", \"x\": " << json_string(curve.x_name)
+            << ", \"pages_requested\": " << json_string(page_backend_name(curve.pages_requested))
+            << ", \"thresholds\": {";
+        for (size_t i = 0; i < curve.thresholds.size(); ++i) {
+            out << (i ? ", " : "") << json_string(curve.thresholds[i].first) << ": "
+                << json_number(curve.thresholds[i].second);
+        }
+        out << "}, \"points\": [";
+        for (size_t i = 0; i < curve.points.size(); ++i) {
+            const auto &pt = curve.points[i];
+            const auto ci = median_interval(pt.samples);
+            out << (i ? "," : "") << "\n" << indent << "    {\"x\": " << pt.bytes
+                << ", \"median\": " << json_number(pt.per_access)
+                << ", \"ci\": [" << json_number(ci.first) << ", " << json_number(ci.second) << "]"
+                << ", \"pages\": " << json_string(page_backend_name(pt.pages)) << ", \"samples\": [";
+            for (size_t k = 0; k < pt.samples.size(); ++k) out << (k ? ", " : "") << json_number(pt.samples[k]);
+            out << "]}";
+        }
+        out << "]}";
+    }
+    out << "\n" << indent << "]";
+}
+
+static void write_json(std::ostream &out, size_t page_size, const Options &opts, bool cached,
+                       const Report &report, const std::vector<CpuResult> &cpus) {
+    out << "{\n";
+    out << "  \"cached\": " << (cached ? "true" : "false") << ",\n";
+    out << "  \"page_size\": " << page_size << ",\n";
+    out << "  \"timer\": " << json_string(timer_name()) << ",\n";
+    out << "  \"unit\": " << json_string(timer_unit()) << ",\n";
+    out << "  \"total_accesses\": " << opts.total_accesses << ",\n";
+    out << "  \"trials\": " << opts.trials << ",\n";
+
+    if (opts.per_cpu) {
+        out << "  \"cpus\": [";
+        for (size_t i = 0; i < cpus.size(); ++i) {
+            out << (i ? "," : "") << "\n    {\n      \"cpu\": " << cpus[i].cpu << ",\n";
+            write_json_report(out, cpus[i].report, "      ");
+            out << "\n    }";
+        }
+        out << "\n  ]";
+        // machine-wide probes (--bandwidth, --c2c, --numa, --prefetch-msr) of a per-CPU run
+        if (!report.estimates.empty()) {
+            out << ",\n  \"machine\": {\n";
+            write_json_report(out, report, "    ");
+            out << "\n  }";
+        }
+        out << "\n";
+    } else {
+        write_json_report(out, report, "  ");
+        out << "\n";
+    }
+    out << "}\n";
+}
+
+// RFC 4180: a field with a comma, quote or line break is quoted, and quotes inside it are doubled.
+static std::string csv_field(const std::string &str) {
+    if (str.find_first_of(",\"\r\n") == std::string::npos) return str;
+    std::string out = "\"";
+    for (char c: str) {
+        if (c == '"') out += '"';
+        out += c;
+    }
+    return out + "\"";
+}
+
+static void write_csv_report(std::ostream &out, const std::string &cpu, const Report &report) {
+    for (const auto &e: report.estimates)
+        out << "estimate," << cpu << ",," << csv_field(e.first) << ",," << json_number(e.second) << "\n";
+
+    for (size_t i = 0; i < report.levels.size(); ++i) {
+        out << "level," << cpu << ",hierarchy," << report.levels[i].bytes << "," << i + 1 << ","
+            << json_number(report.levels[i].per_access) << "\n";
+        out << "level_interval," << cpu << ",hierarchy," << report.levels[i].bytes_lo << "," << i + 1 << ","
+            << report.levels[i].bytes_hi << "\n";
+    }
+
+    for (const auto &n: report.notes)
+        out << "note," << cpu << ",," << csv_field(n.first) << ",," << csv_field(n.second) << "\n";
+
+    for (const auto &curve: report.curves) {
+        for (const auto &t: curve.thresholds)
+            out << "threshold," << cpu << "," << csv_field(curve.probe) << "," << csv_field(t.first) << ",,"
+                << json_number(t.second) << "\n";
+
+        for (const auto &pt: curve.points) {
+            out << "median," << cpu << "," << csv_field(curve.probe) << "," << pt.bytes << ",,"
+                << json_number(pt.per_access) << "\n";
+            out << "pages," << cpu << "," << csv_field(curve.probe) << "," << pt.bytes << ",,"
+                << page_backend_name(pt.pages) << "\n";
+            for (size_t k = 0; k < pt.samples.size(); ++k) {
+                out << "sample," << cpu << "," << csv_field(curve.probe) << "," << pt.bytes << "," << k << ","
+                    << json_number(pt.samples[k]) << "\n";
+            }
+        }
+    }
+}
+
+// One flat table: for level rows `key` is the size and `trial` the level number.
+static void write_csv(std::ostream &out, const Options &opts, const Report &report, const std::vector<CpuResult> &cpus) {
+    out << "kind,cpu,probe,key,trial,value\n";
+    if (opts.per_cpu) {
+        for (const auto &r: cpus) write_csv_report(out, std::to_string(r.cpu), r.report);
+        if (!report.estimates.empty()) write_csv_report(out, "all", report);
+    } else {
+        write_csv_report(out, "", report);
+    }
+}
+
+
+static void write_structured(const Options &opts, size_t page_size, bool cached, const Report &report,
+                             const std::vector<CpuResult> &cpus) {
+    std::ofstream file;
+    if (!opts.output_path.empty()) {
+        file.open(opts.output_path);
+        if (!file) throw std::runtime_error("Не удалось открыть файл " + opts.output_path);
+    }
+    std::ostream &out = opts.output_path.empty() ? std::cout : file;
+
+    if (opts.format == OutputFormat::Json) write_json(out, page_size, opts, cached, report, cpus);
+    else write_csv(out, opts, report, cpus);
+}
+
+// *------------------------------------------------------------------------------------*
+// |                                  RESULT CACHE                                      |
+// *------------------------------------------------------------------------------------*
+static std::string cpuinfo_field(const std::string &name) {
+    std::ifstream in("/proc/cpuinfo");
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.rfind(name, 0) != 0) continue;
+        const size_t colon = line.find(':');
+        if (colon == std::string::npos) continue;
+        const size_t value = line.find_first_not_of(" \t", colon + 1);
+        return value == std::string::npos ? std::string() : line.substr(value);
+    }
+    return "";
+}
+
+static std::string cpu_identity() {
+    std::ostringstream id;
+#ifdef HAVE_TSC
+    unsigned eax = 0, ebx = 0, ecx = 0, edx = 0;
+    const std::string vendor = cpu_vendor();
+
+    __get_cpuid(1, &eax, &ebx, &ecx, &edx);
+    unsigned family = (eax >> 8) & 0xf;
+    unsigned model = (eax >> 4) & 0xf;
+    if (family == 0xf) family += (eax >> 20) & 0xff;
+    if (family == 0x6 || family >= 0xf) model |= ((eax >> 16) & 0xf) << 4;
+
+    id << "vendor=" << vendor << " family=" << family << " model=" << model << " stepping=" << (eax & 0xf);
+#else
+    id << "implementer=" << cpuinfo_field("CPU implementer") << " part=" << cpuinfo_field("CPU part")
+       << " variant=" << cpuinfo_field("CPU variant") << " revision=" << cpuinfo_field("CPU revision");
+#endif
+
+    std::string microcode = read_sysfs("/sys/devices/system/cpu/cpu0/microcode/version");
+    if (microcode.empty()) microcode = cpuinfo_field("microcode");
+    id << " microcode=" << microcode;
+    return id.str();
+}
+
+static std::string cache_key(size_t page_size, const Options &opts) {
+    std::ostringstream key;
+    key << cpu_identity()
+        << " page=" << page_size
+        << " timer=" << timer_name()
+        << " i=" << opts.total_accesses
+        << " r=" << opts.trials
+        << " precision=" << opts.precision
+        << " tolerance=" << opts.tolerance
+        << " budget=" << opts.budget_ms
+        << " max=" << opts.max_bytes
+        << " pages_size=" << page_backend_name(opts.pages_size)
+        << " pages_assoc=" << page_backend_name(opts.pages_assoc)
+        << " pages_stride=" << page_backend_name(opts.pages_stride)
+        << " pages_mlp=" << page_backend_name(opts.pages_mlp)
+        << " pages_prefetch=" << page_backend_name(opts.pages_prefetch)
+        << " pages_sets=" << page_backend_name(opts.pages_sets)
+        << " pages_evict=" << page_backend_name(opts.pages_evict)
+        << " pages_policy=" << page_backend_name(opts.pages_policy)
+        << " hierarchy=" << opts.hierarchy
+        << " tlb=" << opts.tlb
+        << " bandwidth=" << opts.bandwidth
+        << " isa=" << opts.isa
+        << " mlp=" << opts.mlp
+        << " prefetch=" << opts.prefetch
+        << " prefetch_msr=" << opts.prefetch_msr
+        << " c2c=" << opts.c2c
+        << " numa=" << opts.numa
+        << " mem_node=" << opts.mem_node
+        << " cpu_node=" << opts.cpu_node
+        << " check=" << opts.cross_check
+        << " sets=" << opts.sets
+        << " evict=" << opts.evict
+        << " policy=" << opts.policy
+        << " per_cpu=" << opts.per_cpu
+        << " cpus=";
+    for (int cpu: opts.cpus) key << cpu << ",";
+    return key.str();
+}
+
+static std::filesystem::path cache_path(const std::string &key) {
+    std::filesystem::path dir;
+    if (const char *xdg = std::getenv("XDG_CACHE_HOME"); xdg && *xdg) dir = xdg;
+    else if (const char *home = std::getenv("HOME"); home && *home) dir = std::filesystem::path(home) / ".cache";
+    else dir = std::filesystem::temp_directory_path();
+
+    // FNV-1a; the full key is stored inside the file and compared on load
+    uint64_t hash = 1469598103934665603ULL;
+    for (unsigned char c: key) hash = (hash ^ c) * 1099511628211ULL;
+
+    std::ostringstream name;
+    name << std::hex << hash << ".txt";
+    return dir / "cpu_info" / name.str();
+}
+
+// Format: a header, the key, then per report a `report <cpu>` line (-1 for a single run) followed by its
+// `estimate <name> <value>`, `level <bytes> <per_access> <bytes_lo> <bytes_hi>` and `note <name> <reason>` lines.
+// Curves are not cached.
+static bool load_cache(const std::filesystem::path &path, const std::string &key,
+                       Report &report, std::vector<CpuResult> &cpus) {
+    std::ifstream in(path);
+    std::string line;
+    if (!std::getline(in, line) || line != "cpu_info-cache 2") return false;
+    if (!std::getline(in, line) || line != "key " + key) return false;
+
+    Report *cur = nullptr;
+    while (std::getline(in, line)) {
+        std::istringstream row(line);
+        std::string kind;
+        row >> kind;
+
+        if (kind == "report") {
+            int cpu = -1;
+            row >> cpu;
+            if (cpu < 0) {
+                cur = &report;
+            } else {
+                cpus.push_back({cpu, {}});
+                cur = &cpus.back().report;
+            }
+        } else if (cur && kind == "estimate") {
+            std::string name;
+            double value = 0.0;
+            row >> name >> value;
+            cur->estimates.emplace_back(name, value);
+        } else if (cur && kind == "level") {
+            CacheLevel level{0, 0.0};
+            row >> level.bytes >> level.per_access >> level.bytes_lo >> level.bytes_hi;
+            cur->levels.push_back(level);
+        } else if (cur && kind == "note") {
+            std::string name, reason;
+            row >> name;
+            std::getline(row >> std::ws, reason);
+            cur->notes.emplace_back(name, reason);
+            continue;
+        } else {
+            return false;
+        }
+        if (!row) return false;
+    }
+    return true;
+}
+
+static void save_cache(const std::filesystem::path &path, const std::string &key,
+                       const Report &report, const std::vector<CpuResult> &cpus) {
+    std::error_code ec;
+    std::filesystem::create_directories(path.parent_path(), ec);
+
+    auto tmp = path;
+    tmp += ".tmp";
+    {
+        std::ofstream out(tmp);
+        if (!out) return;
+        out.precision(17);
+        out << "cpu_info-cache 2\nkey " << key << "\n";
+
+        auto write_report = [&out](int cpu, const Report &r) {
+            out << "report " << cpu << "\n";
+            for (const auto &e: r.estimates) out << "estimate " << e.first << " " << e.second << "\n";
+            for (const auto &l: r.levels)
+                out << "level " << l.bytes << " " << l.per_access << " " << l.bytes_lo << " " << l.bytes_hi << "\n";
+            for (const auto &n: r.notes) out << "note " << n.first << " " << n.second << "\n";
+        };
+
+        if (cpus.empty() || !report.estimates.empty()) write_report(-1, report);
+        for (const auto &r: cpus) write_report(r.cpu, r.report);
+        if (!out) return;
+    }
+    std::filesystem::rename(tmp, path, ec);
+}
+
+
+// *------------------------------------------------------------------------------------*
+// |                                   LIBRARY API                                      |
+// *------------------------------------------------------------------------------------*
+static PageBackend page_backend(cpu_info::Pages pages) {
+    switch (pages) {
+        case cpu_info::Pages::Thp: return PageBackend::Thp;
+        case cpu_info::Pages::Huge2M: return PageBackend::Huge2M;
+        case cpu_info::Pages::Huge1G: return PageBackend::Huge1G;
+        default: return PageBackend::Default;
+    }
+}
+
+static TimerBackend timer_backend(cpu_info::Timer timer) {
+    switch (timer) {
+        case cpu_info::Timer::Tsc: return TimerBackend::Tsc;
+        case cpu_info::Timer::Perf: return TimerBackend::Perf;
+        default: return TimerBackend::Chrono;
+    }
+}
+
+static Options to_options(const cpu_info::Config &config) {
+    Options opts;
+    opts.total_accesses = config.accesses;
+    opts.trials = config.trials;
+    opts.precision = config.precision;
+    opts.tolerance = config.tolerance;
+    opts.budget_ms = config.budget_ms;
+    opts.max_bytes = config.max_bytes;
+    opts.timer = timer_backend(config.timer);
+    opts.pages_size = opts.pages_assoc = opts.pages_stride = page_backend(config.pages);
+    opts.mem_node = config.mem_node;
+    return opts;
+}
+
+static cpu_info::Estimate to_estimate(const Report &report, const std::string &name, size_t value,
+                                      size_t reported) {
+    cpu_info::Estimate result;
+    result.value = value;
+    result.reported = reported;
+    result.source = "measured";
+    result.lo = has_estimate(report, name + "_lo") ? size_t(estimate(report, name + "_lo")) : value;
+    result.hi = has_estimate(report, name + "_hi") ? size_t(estimate(report, name + "_hi")) : value;
+    for (const auto &n: report.notes)
+        if (n.first == name) result.reason = n.second;
+    return result;
+}
+
+static int config_cpu(const cpu_info::Config &config) {
+    return config.cpu >= 0 ? config.cpu : current_cpu();
+}
+
+// `name` is one of the reported_l1d_* estimates without the prefix.
+static cpu_info::Estimate reported_estimate(const cpu_info::Config &config, const std::string &name) {
+    Report report;
+    add_reported_estimates(report, config_cpu(config));
+
+    cpu_info::Estimate result;
+    result.value = result.lo = result.hi = result.reported = size_t(estimate(report, "reported_" + name));
+    result.source = note(report, "reported");
+    if (result.value == 0) result.reason = "not reported";
+    return result;
+}
+
+template<class Result>
+static std::future<Result> ready(Result result) {
+    std::promise<Result> promise;
+    promise.set_value(std::move(result));
+    return promise.get_future();
+}
+
+// The probes share the process-wide timer and sampling settings and would disturb each other's timing, so one
+// runs at a time, each on a fresh thread that owns the per-thread state (budget, cancellation, memory node,
+// pinning).
+template<class Result, class Probe>
+static std::future<Result> run_probe_async(const cpu_info::Config &config, cpu_info::CancelToken cancel, Probe probe) {
+    return std::async(std::launch::async, [config, cancel, probe]() {
+        static std::mutex serial;
+        std::lock_guard<std::mutex> lock(serial);
+
+        g_cancel = &cancel;
+        if (config.cpu >= 0) pin_to_cpu(config.cpu);
+
+        Options opts = to_options(config);
+        setup_timer(opts);
+        g_mem_node = opts.mem_node;
+        g_sampling.precision = opts.precision;
+
+        start_budget(opts);
+        budget_phase(1);
+        Result result = probe(size_t(sysconf(_SC_PAGESIZE)), opts);
+        result.complete = g_budget.skipped == 0;
+        g_budget.active = false;
+        return result;
+    });
+}
+
+std::future<cpu_info::Estimate> cpu_info::probe_l1_size_async(const Config &config, CancelToken cancel) {
+    const Estimate reported = reported_estimate(config, "l1d_bytes");
+    if (config.prefer_reported && reported) return ready(reported);
+
+    return run_probe_async<Estimate>(config, cancel, [reported](size_t, const Options &opts) {
+        Report report;
+        const size_t bytes = detect_size_L1(opts, &report);
+        return to_estimate(report, "l1_bytes", bytes, reported.value);
+    });
+}
+
+std::future<cpu_info::Estimate> cpu_info::probe_associativity_async(const Config &config, CancelToken cancel) {
+    const Estimate reported = reported_estimate(config, "l1d_ways");
+    if (config.prefer_reported && reported) return ready(reported);
+
+    return run_probe_async<Estimate>(config, cancel, [reported](size_t page_size, const Options &opts) {
+        Report report;
+        const size_t ways = detect_associativity_L1(page_size, opts, &report);
+        return to_estimate(report, "l1_ways", ways, reported.value);
+    });
+}
+
+std::future<cpu_info::Estimate> cpu_info::probe_line_size_async(const Config &config, CancelToken cancel) {
+    const Estimate reported = reported_estimate(config, "l1d_line_bytes");
+    if (config.prefer_reported && reported) return ready(reported);
+
+    return run_probe_async<Estimate>(config, cancel, [reported](size_t page_size, const Options &opts) {
+        Report report;
+        const size_t line = detect_stride_size_L1(page_size, opts, &report);
+        return to_estimate(report, "l1_line_bytes", line, reported.value);
+    });
+}
+
+std::future<cpu_info::Hierarchy> cpu_info::probe_hierarchy_async(const Config &config, CancelToken cancel) {
+    if (config.prefer_reported) {
+        Hierarchy result;
+        for (const auto &cache: ::reported_caches(config_cpu(config), &result.source))
+            if (cache.type != "Instruction") result.caches.push_back({cache.bytes, cache.bytes, cache.bytes, 0.0});
+        if (!result.caches.empty()) return ready(result);
+    }
+
+    return run_probe_async<Hierarchy>(config, cancel, [](size_t, const Options &opts) {
+        Report report;
+        const auto levels = detect_hierarchy(opts, &report);
+
+        Hierarchy result;
+        for (const auto &level: levels) {
+            if (level.bytes == 0) result.memory_latency = level.per_access;
+            else result.caches.push_back({level.bytes, level.bytes_lo, level.bytes_hi, level.per_access});
+        }
+        if (!report.notes.empty()) result.reason = report.notes.front().second;
+        result.source = "measured";
+        return result;
+    });
+}
+
+std::vector<cpu_info::CacheInfo> cpu_info::reported_caches(int cpu) {
+    std::vector<CacheInfo> result;
+    for (const auto &cache: ::reported_caches(cpu >= 0 ? cpu : current_cpu()))
+        result.push_back({cache.level, cache.type, cache.bytes, cache.ways, cache.line, cache.sets});
+    return result;
+}
+
+cpu_info::Estimate cpu_info::probe_l1_size(const Config &config) {
+    return probe_l1_size_async(config).get();
+}
+
+cpu_info::Estimate cpu_info::probe_associativity(const Config &config) {
+    return probe_associativity_async(config).get();
+}
+
+cpu_info::Estimate cpu_info::probe_line_size(const Config &config) {
+    return probe_line_size_async(config).get();
+}
+
+cpu_info::Hierarchy cpu_info::probe_hierarchy(const Config &config) {
+    return probe_hierarchy_async(config).get();
+}
+
+// *------------------------------------------------------------------------------------*
+// |                                  COMMAND LINE                                      |
+// *------------------------------------------------------------------------------------*
+int cpu_info::run_cli(int argc, char **argv) {
+
+    auto options = parse_args(argc, argv);
+    setup_timer(options);
+
+    if (options.cpu_node >= 0) pin_to_cpus(node_cpus(options.cpu_node));
+    g_mem_node = options.mem_node;
+    g_sampling.precision = options.precision;
+
+    // keep the structured document in one piece: all prose goes to stderr until it is written
+    std::streambuf *stdout_buf = std::cout.rdbuf();
+    if (options.format != OutputFormat::Text && options.output_path.empty()) std::cout.rdbuf(std::cerr.rdbuf());
+
+    if (options.verbose || options.self_check) {
+        const double overhead = harness_overhead_ns();
+        if (options.timer == TimerBackend::Perf) {
+            std::cout << "Harness overhead: " << overhead << " cycles per measurement\n";
+        } else {
+            std::cout << "Harness overhead: " << overhead << " ns per measurement ("
+                      << overhead / double(options.total_accesses) << " ns/access)\n";
+        }
+        if (options.self_check) return 0;
+    }
+
+    const auto page_size = size_t(sysconf(_SC_PAGESIZE));
+    std::cout << "Page size: " << page_size << " bytes\n";
+
+    Report report;
+    std::vector<CpuResult> cpus;
+
+    if (options.reported) {
+        add_reported_estimates(report, current_cpu());
+        print_reported_estimate(std::cout, report);
+        if (options.format != OutputFormat::Text) {
+            std::cout.rdbuf(stdout_buf);
+            write_structured(options, page_size, false, report, cpus);
+        }
+        return 0;
+    }
+
+    const std::string key = cache_key(page_size, options);
+    const auto path = cache_path(key);
+    const bool cached = options.use_cache && !options.refresh && load_cache(path, key, report, cpus);
+
+    if (cached) {
+        if (options.verbose) std::cout << "Using cached results from " << path.string() << "\n";
+        if (options.per_cpu) {
+            print_per_cpu_table(cpus, options.hierarchy);
+            print_bandwidth_estimate(std::cout, report);
+            print_c2c_estimate(std::cout, report);
+            print_numa_estimate(std::cout, report);
+            print_prefetch_estimate(std::cout, report);
+        } else {
+            print_estimates(std::cout, report);
+        }
+    } else {
+        if (options.per_cpu) {
+            cpus = run_per_cpu(page_size, options);
+            print_per_cpu_table(cpus, options.hierarchy);
+            if (options.bandwidth) {
+                detect_bandwidth(options, report);
+                print_bandwidth_estimate(std::cout, report);
+            }
+            if (options.c2c) {
+                detect_c2c(options, report);
+                print_c2c_estimate(std::cout, report);
+            }
+            if (options.numa) {
+                detect_numa(options, report);
+                print_numa_estimate(std::cout, report);
+            }
+            if (options.prefetch_msr) {
+                detect_prefetch_msr(page_size, options, report);
+                print_prefetch_estimate(std::cout, report);
+            }
+        } else {
+            report = run_probes(page_size, options, &std::cout);
+        }
+        // a budget that ran out gives a best guess; caching it would keep a later run from measuring properly
+        bool confident = !has_estimate(report, "confident") || estimate(report, "confident") > 0;
+        for (const auto &cpu: cpus)
+            if (has_estimate(cpu.report, "confident") && estimate(cpu.report, "confident") == 0) confident = false;
+        if (options.use_cache && confident) save_cache(path, key, report, cpus);
+    }
+
+    if (options.format != OutputFormat::Text) {
+        std::cout.rdbuf(stdout_buf);
+        write_structured(options, page_size, cached, report, cpus);
+    }
+
+    return 0;
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+// Public interface of the cpu_info library: the cache probes of the cpu_info tool, callable in-process.
+//
+// Every probe runs on a worker thread of its own (pinned to Config::cpu if given) and probes run one at a time:
+// concurrent calls queue up instead of disturbing each other's timing. The blocking functions wait for the result;
+// the *_async ones return a future and can be stopped through a CancelToken, in which case the future throws
+// Cancelled. Other failures (no huge pages, unsupported timer, ...) are thrown as std::runtime_error.
+//
+// Cancellation is cooperative: the token is checked before every trial, buffer allocation, ring resize and
+// refinement step, so a probe stops within one of them. The longest is a trial or a resize of the largest ring
+// (Config::max_bytes, by default 4x the LLC), a fraction of a second to a few seconds on a DRAM-sized ring.
+
+#include <atomic>
+#include <cstddef>
+#include <future>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace cpu_info {
+
+enum class Timer {
+    Chrono,     // nanoseconds
+    Tsc,        // TSC cycles (x86)
+    Perf,       // core cycles via perf_event_open (Linux)
+};
+
+enum class Pages {
+    Default,
+    Thp,
+    Huge2M,
+    Huge1G,
+};
+
+// Same knobs and defaults as the command-line options of the same meaning.
+struct Config {
+    std::size_t accesses = 1'600'000;   // accesses per measurement (-i)
+    int trials = 7;                     // most trials per point (-r)
+    double precision = 0.02;            // stop a point once its median is this tight (--precision), 0 = all trials
+    double tolerance = 0.03;            // boundary bisection precision, relative to the size (--tolerance)
+    double budget_ms = 0.0;             // wall-clock limit of one probe (--budget), 0 = none
+    std::size_t max_bytes = 0;          // upper bound of the hierarchy sweep (--max-size), 0 = 4 x LLC
+    Timer timer = Timer::Chrono;
+    Pages pages = Pages::Default;
+    int cpu = -1;                       // CPU to probe on, -1 = wherever the scheduler puts the worker
+    int mem_node = -1;                  // NUMA node for the buffers (--mem-node), -1 = local
+    bool prefer_reported = false;       // answer from sysfs/CPUID when they have the value, measure otherwise
+};
+
+// A cache as sysfs or CPUID describe it.
+struct CacheInfo {
+    int level;
+    std::string type;           // Data, Instruction or Unified
+    std::size_t bytes;
+    std::size_t ways;
+    std::size_t line_bytes;
+    std::size_t sets;
+};
+
+// A single value and the interval it was narrowed down to.
+struct Estimate {
+    std::size_t value = 0;      // 0 = not detected
+    std::size_t lo = 0;         // interval the value lies in; lo == hi == value when there is none
+    std::size_t hi = 0;
+    std::string reason;         // why value is 0
+    bool complete = true;       // false if Config::budget_ms ran out before every point was measured
+    std::size_t reported = 0;   // what sysfs/CPUID say, 0 = nothing; compare with value to catch lying VMs
+    std::string source;         // measured, sysfs or cpuid
+
+    explicit operator bool() const { return value != 0; }
+};
+
+struct Level {
+    std::size_t bytes;          // the level ends here
+    std::size_t bytes_lo;       // interval the boundary lies in
+    std::size_t bytes_hi;
+    double latency;             // per access, in Config::timer units; 0 if reported rather than measured
+};
+
+struct Hierarchy {
+    std::vector<Level> caches;  // from L1 outwards; empty if no step was found
+    double memory_latency = 0;  // beyond the last cache
+    std::string reason;         // why caches is empty
+    bool complete = true;
+    std::string source;         // measured, sysfs or cpuid
+};
+
+class Cancelled : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+// Shared stop flag: copies refer to the same flag.
+class CancelToken {
+public:
+    CancelToken() : flag_(std::make_shared<std::atomic<bool>>(false)) {}
+
+    void cancel() const noexcept { flag_->store(true); }
+    bool cancelled() const noexcept { return flag_->load(); }
+
+private:
+    std::shared_ptr<std::atomic<bool>> flag_;
+};
+
+// Instant (microseconds): sysfs of `cpu` (-1 = the calling thread's), CPUID of the calling thread's CPU where
+// sysfs has nothing. Empty if neither describes the caches.
+std::vector<CacheInfo> reported_caches(int cpu = -1);
+
+Estimate probe_l1_size(const Config &config = {});
+Estimate probe_associativity(const Config &config = {});
+Estimate probe_line_size(const Config &config = {});
+Hierarchy probe_hierarchy(const Config &config = {});
+
+std::future<Estimate> probe_l1_size_async(const Config &config = {}, CancelToken cancel = {});
+std::future<Estimate> probe_associativity_async(const Config &config = {}, CancelToken cancel = {});
+std::future<Estimate> probe_line_size_async(const Config &config = {}, CancelToken cancel = {});
+std::future<Hierarchy> probe_hierarchy_async(const Config &config = {}, CancelToken cancel = {});
+
+// The cpu_info command line: parses argv and prints to stdout, returns the exit code.
+int run_cli(int argc, char **argv);
+
+}
@@ -1,466 +1,5 @@
-#include <algorithm>
-#include <cstddef>
-#include <cstdint>
-#include <cstdlib>
-#include <cstring>
-#include <iostream>
-#include <random>
-#include <vector>
-#include <string>
-#include <chrono>
-#include <functional>
-#include <unistd.h>
-
-#if defined(__GNUC__) || defined(__clang__)
-#define NOINLINE __attribute__((noinline))
-#else
-#define NOINLINE
-#endif
-
-#define NOOPTIMISE(PTR) fprintf(stdin,"%p",(PTR))
-
-using high_resolution_clock = std::chrono::high_resolution_clock;
-
-// *------------------------------------------------------------------------------------*
-// |                                 CLI TOOLS                                          |
-// *------------------------------------------------------------------------------------*
-struct Options {
-    bool verbose = false;
-    size_t total_accesses = 16'000'00ULL;
-    int trials = 7;
-};
-
-
-static void print_usage(const char *prog) {
-    std::cerr << "Использование: " << prog << " [-v] [-i <int>|-i<int>] [-r <int>|-r<int>]\n"
-              << "  -v         Включает подробный режим\n"
-              << "  -i <int>   Количество итераций обхода данных\n"
-              << "  -r <int>   Количество прогонов вычислений\n"
-              << "  -h, --help Показать справку\n";
-}
-
-static Options parse_args(int argc, char *argv[]) {
-    Options opt;
-
-    for (int idx = 1; idx < argc; ++idx) {
-        std::string arg = argv[idx];
-
-        if (arg == "-h" || arg == "--help") {
-            print_usage(argv[0]);
-            std::exit(0);
-        } else if (arg == "-v") {
-            opt.verbose = true;
-        } else if (arg == "-i" || arg.rfind("-i", 0) == 0) {
-            std::string valStr;
-            if (arg == "-i") {
-                if (idx + 1 >= argc) throw std::runtime_error("Ожидалось значение после -i");
-                valStr = argv[++idx];
-            } else {
-                valStr = arg.substr(2);
-                if (valStr.empty()) throw std::runtime_error("Ожидалось значение после -i");
-            }
-
-            size_t value = std::stoull(valStr);
-            opt.total_accesses = value;
-        } else if (arg == "-r" || arg.rfind("-r", 0) == 0) {
-            std::string valStr;
-            if (arg == "-r") {
-                if (idx + 1 >= argc) throw std::runtime_error("Ожидалось значение после -r");
-                valStr = argv[++idx];
-            } else {
-                valStr = arg.substr(2);
-                if (valStr.empty()) throw std::runtime_error("Ожидалось значение после -r");
-            }
-            int value = std::stoi(valStr);
-            opt.trials = value;
-        } else {
-            throw std::runtime_error("Неизвестный аргумент: " + arg);
-        }
-    }
-
-    return opt;
-}
-
-// *------------------------------------------------------------------------------------*
-// |                                DATA UTILITIES                                      |
-// *------------------------------------------------------------------------------------*
-struct SizePoint {
-    size_t bytes;
-    double ns_per_access;
-};
-
-static double median(std::vector<double> &v) {
-    if (v.empty()) return 0.0;
-    auto n = v.size();
-    std::nth_element(v.begin(), v.begin() + n / 2, v.end());
-    double m = v[n / 2];
-    if (n % 2 == 0) {
-        auto it = std::max_element(v.begin(), v.begin() + n / 2);
-        m = (m + *it) * 0.5;
-    }
-    return m;
-}
-
-static size_t detect_jump_bytes(
-        const std::vector<SizePoint> &pts,
-        double exceed_base_ratio = 1.35,
-        double local_jump_ratio = 1.18
-) {
-    if (pts.size() < 10) return 0;
-
-    const size_t baseN = std::min<size_t>(8, pts.size());
-    std::vector<double> baseVals;
-    baseVals.reserve(baseN);
-    for (size_t i = 0; i < baseN; ++i) baseVals.push_back(pts[i].ns_per_access);
-    const double base = median(baseVals);
-
-    const int confirm_points = 3;
-
-    for (size_t i = 1; i + confirm_points < pts.size(); ++i) {
-        const double cur = pts[i].ns_per_access;
-        const double prev = pts[i - 1].ns_per_access;
-
-        if (!(cur >= base * exceed_base_ratio && cur >= prev * local_jump_ratio))
-            continue;
-
-        bool ok = true;
-        for (int k = 1; k <= confirm_points; ++k) {
-            if (pts[i + k].ns_per_access < base * (exceed_base_ratio * 0.98)) {
-                ok = false;
-                break;
-            }
-        }
-        if (ok) return pts[i - 1].bytes;
-    }
-    return 0;
-}
-
-static size_t detect_jump_bytes_relaxed(const std::vector<SizePoint> &pts) {
-    double baseline = pts.empty() ? 0.0 : pts.front().ns_per_access;
-    std::size_t estimated = 0;
-
-    const double exceed_base_ratio = 1.30;
-    const double local_jump_ratio = 1.15;
-
-    for (std::size_t i = 1; i < pts.size(); ++i) {
-        double prev = pts[i - 1].ns_per_access;
-        double cur = pts[i].ns_per_access;
-
-        if (cur > baseline * exceed_base_ratio && cur > prev * local_jump_ratio) {
-            estimated = pts[i].bytes;
-            break;
-        }
-    }
-
-    if (estimated == 0) {
-        estimated = std::max_element(pts.begin(), pts.end(), [](auto a, auto b) {
-            return a.ns_per_access < b.ns_per_access;
-        })->bytes;
-    }
-
-    return estimated;
-}
-
-static std::vector<size_t> make_sizes_grid() {
-    std::vector<size_t> s;
-
-    auto add_range = [&](size_t fromKB, size_t toKB, size_t stepKB) {
-        for (size_t kb = fromKB; kb <= toKB; kb += stepKB)
-            s.push_back(kb * 1024);
-    };
-
-    add_range(2, 32, 2);
-    add_range(40, 128, 8);
-    add_range(160, 512, 32);
-    add_range(576, 1024, 64);
-
-    return s;
-}
-
-static void build_random_cycle(std::vector<uint32_t> &next, uint32_t step = 16) {
-    std::vector<uint32_t> idx;
-    idx.reserve(next.size() / step + 1);
-    for (uint32_t i = 0; i < (uint32_t) next.size(); i += step) idx.push_back(i);
-
-    std::mt19937 rng(1234567);
-    std::shuffle(idx.begin(), idx.end(), rng);
-
-    for (size_t k = 0; k + 1 < idx.size(); ++k) next[idx[k]] = idx[k + 1];
-    next[idx.back()] = idx.front();
-
-    for (uint32_t i = 0; i < (uint32_t) next.size(); ++i)
-        if (i % step != 0) next[i] = i;
-}
-
-static std::size_t align_up(std::size_t x, std::size_t align) {
-    return (x + align - 1) & ~(align - 1);
-}
-
-
-static NOINLINE double measure(size_t warm_up, size_t main_loop, const std::function<void(size_t)> &func) {
-    func(warm_up);
-
-    auto t0 = high_resolution_clock::now();
-    func(main_loop);
-    auto t1 = high_resolution_clock::now();
-
-    return std::chrono::duration<double, std::nano>(t1 - t0).count();
-}
-
-// *------------------------------------------------------------------------------------*
-// |                                 L1 SIZE PROBE                                      |
-// *------------------------------------------------------------------------------------*
-static NOINLINE double measure_size_L1(
-        size_t bytes,
-        uint64_t total_accesses,
-        int trials = 3
-) {
-    std::vector<uint32_t> next(bytes);
-    build_random_cycle(next, 16);
-
-    std::vector<double> results;
-    results.reserve(trials);
-
-    for (int t = 0; t < trials; ++t) {
-
-        double ns = measure(200000, total_accesses, [&next](size_t count) {
-            uint32_t cur = 0;
-            for (uint64_t i = 0; i < count; ++i) cur = next[cur];
-
-            NOOPTIMISE(&next + cur);
-        });
-
-        results.push_back(ns / double(total_accesses));
-    }
-    return median(results);
-}
-
-static size_t detect_size_L1(const Options &opts) {
-    const auto sizes = make_sizes_grid();
-
-    std::vector<SizePoint> pts;
-    pts.reserve(sizes.size());
-
-    if (opts.verbose) {
-        std::cout << "\nL1 size probe:\n";
-        std::cout << "Size(KB)\tns/access\n";
-    }
-
-    for (size_t bytes: sizes) {
-        const size_t n = std::max<size_t>(bytes / sizeof(uint32_t), 1024);
-        double ns = measure_size_L1(n, opts.total_accesses, opts.trials);
-        pts.push_back({bytes, ns});
-
-        if (opts.verbose) {
-            std::cout << std::to_string(bytes / 1024) << "\t\t" << ns << "\n";
-        }
-    }
-
-
-    return detect_jump_bytes(pts);
-}
-
-// *------------------------------------------------------------------------------------*
-// |                          L1 ASSOCIATIVITY (WAYS) PROBE                             |
-// *------------------------------------------------------------------------------------*
-static NOINLINE double measure_associativity(
-        size_t k_lines,
-        size_t page_size,
-        uint64_t total_accesses,
-        int trials = 3
-) {
-    const size_t bytes = k_lines * page_size + page_size;
-    void *raw = aligned_alloc(page_size, bytes);
-    if (raw == nullptr) return 0.0;
-    std::memset(raw, 1, bytes);
-
-
-    std::vector<double> results;
-    results.reserve(trials);
-
-    for (int t = 0; t < trials; ++t) {
-        std::vector<std::uintptr_t *> nodes;
-        nodes.reserve(k_lines);
-
-        for (int i = 0; i < k_lines; ++i) {
-            auto p = (std::uintptr_t *) ((unsigned char *) raw + (size_t) i * page_size);
-            nodes.push_back(p);
-        }
-
-        std::mt19937 rng(1000 + t);
-        std::shuffle(nodes.begin(), nodes.end(), rng);
-
-        for (int i = 0; i < k_lines - 1; ++i)
-            *nodes[i] = (std::uintptr_t) nodes[i + 1];
-        *nodes.back() = (std::uintptr_t) nodes.front();
-
-        double ns = measure(200000, total_accesses, [&nodes](size_t count) {
-            auto cur = std::uintptr_t(nodes.front());
-
-            for (uint64_t i = 0; i < count; ++i) cur = *(std::uintptr_t *) cur;
-
-            NOOPTIMISE((std::uintptr_t *) cur);
-        });
-
-        results.push_back(ns / (double) total_accesses);
-    }
-
-    free(raw);
-    return median(results);
-}
-
-static size_t detect_associativity_L1(size_t page_size, const Options &opts) {
-    const size_t k_min = 2;
-    const size_t k_max = 32;
-
-
-    std::vector<SizePoint> pts;
-    pts.reserve(k_max - k_min + 1);
-
-    if (opts.verbose) {
-        std::cout << "\nAssociativity probe (same-set via page stride):\n";
-        std::cout << "k_lines\t ns/access\n";
-    }
-
-    for (size_t k = k_min; k <= k_max; k += 2) {
-        double ns = measure_associativity(k, page_size, opts.total_accesses, opts.trials);
-        pts.push_back({k, ns});
-
-        if (opts.verbose) {
-            std::cout << k << "\t " << ns << "\n";
-        }
-    }
-
-    return detect_jump_bytes(pts, 1.2, 1.05);
-}
-
-// *------------------------------------------------------------------------------------*
-// |                                 L1 STRIDE PROBE                                    |
-// *------------------------------------------------------------------------------------*
-struct Node {
-    Node *next;
-};
-
-static NOINLINE double measure_stride(
-        std::size_t page_size,
-        std::size_t stride,
-        std::uint64_t total_accesses,
-        int trials = 3
-) {
-    std::size_t bytes = 10 * 1024ull * 1024ull;
-    bytes = align_up(bytes, page_size);
-
-
-    void *mem = aligned_alloc(page_size, bytes);
-    if (mem == nullptr) return 0.0;
-    std::memset(mem, 0, bytes);
-
-    auto *base = reinterpret_cast<std::uint8_t *>(mem);
-
-    const std::size_t ptrAlign = alignof(Node);
-    stride = std::max(stride, sizeof(Node));
-    stride = align_up(stride, ptrAlign);
-
-    std::size_t count = bytes / stride;
-    if (count < 2) {
-        free(mem);
-        return std::numeric_limits<double>::infinity();
-    }
-
-    std::vector<double> results;
-    results.reserve(trials);
-
-    for (int t = 0; t < trials; ++t) {
-
-        std::vector<std::size_t> idx(count);
-        for (std::size_t i = 0; i < count; ++i) idx[i] = i;
-
-        std::mt19937_64 rng(1212ULL * t);
-        std::shuffle(idx.begin(), idx.end(), rng);
-
-        for (std::size_t i = 0; i < count; ++i) {
-            auto cur_off = idx[i] * stride;
-            auto next_off = idx[(i + 1) % count] * stride;
-            Node *cur = reinterpret_cast<Node *>(base + cur_off);
-            Node *next = reinterpret_cast<Node *>(base + next_off);
-            cur->next = next;
-        }
-
-        Node *start = reinterpret_cast<Node *>(base + idx[0] * stride);
-
-
-        std::uint64_t steps = total_accesses;
-        if (steps < count * 16) steps = static_cast<std::uint64_t>(count) * 16;
-
-        double ns = measure(200000, steps, [&start](size_t count) {
-            Node *p = start;
-
-            for (uint64_t i = 0; i < count; ++i) p = p->next;
-
-            start = p;
-            NOOPTIMISE(p);
-        });
-
-        results.push_back(ns / static_cast<double>(steps));
-    }
-
-    free(mem);
-
-    return median(results);
-}
-
-
-static size_t detect_stride_size_L1(size_t page_size, const Options &opts) {
-    std::size_t max_stride = 1024;
-
-    if (opts.verbose) {
-        std::cout << "\n\nStride bytes\tns/access\n\n";
-    }
-
-    std::vector<SizePoint> pts;
-
-    for (std::size_t stride = 8; stride <= max_stride; stride *= 2) {
-        double ns = measure_stride(page_size, stride, opts.total_accesses, opts.trials);
-        pts.push_back({stride, ns});
-        if (opts.verbose) {
-            std::cout << (stride) << "\t\t" << ns << "\n";
-        }
-    }
-
-    return detect_jump_bytes_relaxed(pts);
-}
-
+#include "cpu_info.h"
 
 int main(int argc, char **argv) {
-
-    auto options = parse_args(argc, argv);
-
-    const auto page_size = size_t(sysconf(_SC_PAGESIZE));
-    std::cout << "Page size: " << page_size << " bytes\n";
-
-    // 1) L1 size
-    size_t l1_bytes = detect_size_L1(options);
-    if (l1_bytes == 0) {
-        std::cout << "\nL1 size jump not reliably detected in 2KB..1MB.\n";
-    } else {
-        std::cout << "\nEstimated L1 D-cache size: ~" << (l1_bytes / 1024) << " KB\n";
-    }
-
-    // 2) associativity (ways)
-    size_t ways = detect_associativity_L1(page_size, options);
-    if (ways == 0) {
-        std::cout << "\nL1 associativity not reliably detected.\n";
-    } else {
-        std::cout << "\nEstimated L1 D-cache associativity: ~" << ways << "-way\n";
-    }
-
-    // 3) cache line size
-    size_t line_bytes = detect_stride_size_L1(page_size, options);
-    if (line_bytes == 0) {
-        std::cout << "\nL1 cache line size not reliably detected.\n";
-    } else {
-        std::cout << "\nEstimated L1 D-cache line size: ~" << line_bytes << " B\n";
-    }
-
-    return 0;
-}
\ No newline at end of file
+    return cpu_info::run_cli(argc, argv);
+}
@@ -0,0 +1,234 @@
+// Unit tests of the deterministic parts of the probes: policy models, curve segmentation, random rings, sampling
+// and output escaping. The helpers are static, so the test includes the translation unit itself.
+#include "../cpu_info.cpp"
+
+#include <iostream>
+
+static int g_failures = 0;
+
+#define CHECK(cond)                                                                                         \
+    do {                                                                                                    \
+        if (!(cond)) {                                                                                      \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #cond ") failed\n";                      \
+            ++g_failures;                                                                                   \
+        }                                                                                                   \
+    } while (0)
+
+static double order_miss_ratio(Policy policy, size_t ways, const std::string &name) {
+    for (const auto &order: policy_orders(ways))
+        if (order.name == name) return model_miss_ratio(policy, ways, order.lines);
+    throw std::runtime_error("no order " + name);
+}
+
+// *------------------------------------------------------------------------------------*
+// |                                  POLICY MODELS                                     |
+// *------------------------------------------------------------------------------------*
+static void test_policy_set_victims() {
+    PolicySet lru(Policy::Lru, 4);
+    for (int line = 0; line < 4; ++line) CHECK(!lru.access(line));
+    CHECK(lru.access(0));
+    CHECK(!lru.access(4));      // evicts 1, the least recently used
+    CHECK(lru.access(0));
+    CHECK(!lru.access(1));
+
+    PolicySet fifo(Policy::Fifo, 4);
+    for (int line = 0; line < 4; ++line) CHECK(!fifo.access(line));
+    CHECK(fifo.access(0));
+    CHECK(!fifo.access(4));     // evicts 0, the first filled, although it was just used
+    CHECK(!fifo.access(0));
+}
+
+static void test_policy_orders() {
+    for (size_t ways: {8, 16}) {
+        for (Policy policy: policies) CHECK(order_miss_ratio(policy, ways, "loop_w") == 0.0);
+        for (Policy policy: {Policy::Lru, Policy::Fifo, Policy::TreePlru, Policy::Srrip})
+            CHECK(order_miss_ratio(policy, ways, "loop_w+1") == 1.0);
+
+        // bimodal insertion keeps part of a thrashing loop, LRU keeps none of it
+        CHECK(order_miss_ratio(Policy::Brrip, ways, "loop_2w") < 1.0);
+        CHECK(order_miss_ratio(Policy::Lru, ways, "loop_2w") == 1.0);
+
+        CHECK(order_miss_ratio(Policy::Lru, ways, "sawtooth") == 1.0 / double(ways));
+        CHECK(order_miss_ratio(Policy::Fifo, ways, "sawtooth") > 0.5);
+        CHECK(order_miss_ratio(Policy::Srrip, ways, "scan") < order_miss_ratio(Policy::Lru, ways, "scan"));
+        CHECK(order_miss_ratio(Policy::Lru, ways, "hot") < order_miss_ratio(Policy::Fifo, ways, "hot"));
+    }
+}
+
+// the probe classifies by these orders, so no two models may score the same on all of them
+static void test_policy_orders_tell_policies_apart() {
+    for (size_t ways: {8, 12, 16}) {
+        std::vector<std::vector<double>> scores;
+        for (Policy policy: policies) {
+            std::vector<double> s;
+            for (const auto &order: policy_orders(ways)) s.push_back(model_miss_ratio(policy, ways, order.lines));
+            scores.push_back(s);
+        }
+        for (size_t a = 0; a < scores.size(); ++a)
+            for (size_t b = a + 1; b < scores.size(); ++b) CHECK(scores[a] != scores[b]);
+    }
+}
+
+// *------------------------------------------------------------------------------------*
+// |                                  SEGMENTATION                                      |
+// *------------------------------------------------------------------------------------*
+// A curve of plateaus, points * 2^i bytes apart from 4 KB, each point with trials 1% around its level.
+static std::vector<SizePoint> staircase(const std::vector<std::pair<size_t, double>> &plateaus) {
+    std::vector<SizePoint> pts;
+    size_t bytes = 4096;
+    for (const auto &plateau: plateaus) {
+        for (size_t i = 0; i < plateau.first; ++i, bytes *= 2) {
+            const double jitter = 1.0 + 0.005 * double(int(pts.size() % 3) - 1);
+            const double level = plateau.second * jitter;
+            pts.push_back({bytes, level, {level * 0.99, level, level * 1.01}});
+        }
+    }
+    return pts;
+}
+
+static void test_segment_curve() {
+    const auto pts = staircase({{5, 1.0}, {5, 4.0}, {5, 40.0}});
+    const auto seg = segment_curve(pts, 1.3);
+    CHECK(seg.reason.empty());
+    CHECK(seg.segments.size() == 3);
+    if (seg.segments.size() == 3) {
+        CHECK(seg.segments[0].from == 0 && seg.segments[0].to == 5);
+        CHECK(seg.segments[1].from == 5 && seg.segments[1].to == 10);
+        CHECK(seg.segments[2].from == 10 && seg.segments[2].to == 15);
+        CHECK(std::fabs(seg.segments[1].level - 4.0) < 0.1);
+    }
+
+    // a step below min_step_ratio is merged away
+    CHECK(segment_curve(staircase({{6, 1.0}, {6, 1.1}}), 1.3).segments.size() == 1);
+    CHECK(segment_curve({}, 1.3).reason == "no points");
+}
+
+static void test_detect_levels() {
+    const auto pts = staircase({{5, 1.0}, {5, 4.0}, {5, 40.0}});
+    std::string reason;
+    const auto levels = detect_levels(pts, 1.3, &reason);
+    CHECK(levels.size() == 3);
+    if (levels.size() == 3) {
+        CHECK(levels[0].bytes == pts[4].bytes);
+        CHECK(levels[1].bytes == pts[9].bytes);
+        CHECK(levels[2].bytes == 0);
+        CHECK(levels[0].bytes_lo <= levels[0].bytes && levels[0].bytes < levels[0].bytes_hi);
+        CHECK(levels[0].per_access < levels[1].per_access && levels[1].per_access < levels[2].per_access);
+    }
+
+    // a downward step is folded into the plateau before it
+    CHECK(detect_levels(staircase({{6, 4.0}, {6, 1.0}}), 1.3, &reason).size() == 1);
+    CHECK(reason == "no upward step");
+    CHECK(detect_levels({}, 1.3, &reason).empty());
+    CHECK(reason == "no points");
+}
+
+// *------------------------------------------------------------------------------------*
+// |                                  RANDOM RINGS                                      |
+// *------------------------------------------------------------------------------------*
+static void test_random_permutation() {
+    const size_t n = 300000;     // several parallel chunks and buckets
+    std::vector<uint32_t> a(n), b(n), c(n);
+    random_permutation(a.data(), n, 42);
+    random_permutation(b.data(), n, 42);
+    random_permutation(c.data(), n, 43);
+
+    CHECK(a == b);
+    CHECK(a != c);
+    std::vector<uint32_t> sorted = a;
+    std::sort(sorted.begin(), sorted.end());
+    bool identity = true;
+    for (size_t i = 0; i < n; ++i) identity = identity && sorted[i] == i;
+    CHECK(identity);
+}
+
+// Lines of the cycle through line 0, or 0 if the walk does not come back to it.
+static size_t cycle_length(const RandomRing &ring, size_t max_lines, uint32_t step) {
+    size_t len = 0;
+    uint32_t at = 0;
+    do {
+        at = ring.data()[at];
+        if (at % step != 0 || at / step >= max_lines || ++len > max_lines) return 0;
+    } while (at != 0);
+    return len;
+}
+
+static void test_random_ring_resize() {
+    const size_t max_lines = 400000;
+    std::vector<uint32_t> next(max_lines * 16);
+    RandomRing ring(next.data());
+    // small serial growth, a rebuild, serial growth below a quarter, then shrinking
+    for (size_t lines: {1, 100, 5000, 300000, 360000, 1000, 1}) {
+        ring.resize(lines);
+        CHECK(cycle_length(ring, max_lines, 16) == lines);
+    }
+}
+
+// *------------------------------------------------------------------------------------*
+// |                                    SAMPLING                                        |
+// *------------------------------------------------------------------------------------*
+static void test_more_trials() {
+    std::vector<double> results;
+    int runs = 0;
+    while (more_trials(results, 3)) results.push_back(1.0 + 0.1 * ++runs);
+    CHECK(runs == 3);
+
+    // a precision target stops early once the trials agree
+    g_sampling.precision = 0.05;
+    results.clear();
+    runs = 0;
+    while (more_trials(results, 50)) results.push_back(1.0), ++runs;
+    CHECK(runs == g_sampling.min_trials);
+    g_sampling.precision = 0.0;
+
+    cpu_info::CancelToken cancel;
+    g_cancel = &cancel;
+    results.clear();
+    CHECK(more_trials(results, 3));
+    cancel.cancel();
+    bool cancelled = false;
+    try {
+        more_trials(results, 3);
+    } catch (const cpu_info::Cancelled &) {
+        cancelled = true;
+    }
+    CHECK(cancelled);
+    g_cancel = nullptr;
+}
+
+// *------------------------------------------------------------------------------------*
+// |                                STRUCTURED OUTPUT                                   |
+// *------------------------------------------------------------------------------------*
+static void test_escaping() {
+    CHECK(csv_field("l1_bytes") == "l1_bytes");
+    CHECK(csv_field("a,b") == "\"a,b\"");
+    CHECK(csv_field("say \"hi\"") == "\"say \"\"hi\"\"\"");
+    CHECK(csv_field("two\nlines") == "\"two\nlines\"");
+
+    CHECK(json_string("plain") == "\"plain\"");
+    CHECK(json_string("a\"b\\c") == "\"a\\\"b\\\\c\"");
+    CHECK(json_string("a\nb\tc") == "\"a\\nb\\tc\"");
+    CHECK(json_string(std::string("\x01", 1)) == "\"\\u0001\"");
+    CHECK(json_string("узел") == "\"узел\"");
+}
+
+int main() {
+    const std::pair<const char *, void (*)()> tests[] = {
+            {"policy_set_victims",               test_policy_set_victims},
+            {"policy_orders",                    test_policy_orders},
+            {"policy_orders_tell_policies_apart", test_policy_orders_tell_policies_apart},
+            {"segment_curve",                    test_segment_curve},
+            {"detect_levels",                    test_detect_levels},
+            {"random_permutation",               test_random_permutation},
+            {"random_ring_resize",               test_random_ring_resize},
+            {"more_trials",                      test_more_trials},
+            {"escaping",                         test_escaping},
+    };
+
+    for (const auto &test: tests) {
+        const int before = g_failures;
+        test.second();
+        std::cout << (g_failures == before ? "ok      " : "FAILED  ") << test.first << "\n";
+    }
+    return g_failures == 0 ? 0 : 1;
+}